@@ -12,7 +12,16 @@
 #include <sys/time.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
 #include "rbtree.h"
+#include "rb_persist.h"
+#include "rb_image.h"
+#include "rb_shm.h"
+#include "rb_diff.h"
+#include "rb_hash.h"
+#include "rb_bloom.h"
+#include "rb_topdown.h"
+#include "rb_timer.h"
 
 #define CHECK_INSERT 1    // ""ļ⿪(0رգ1)
 #define CHECK_DELETE 1    // "ɾ"ļ⿪(0رգ1)
@@ -297,6 +306,529 @@ void perf_test()
 	}
 }
 
+/* nodes of the module tests */
+#define MODULE_NODES 1000
+
+static int check_failed = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("   check failed, line %d: %s\n", __LINE__, #cond); \
+            check_failed++; \
+        } \
+    } while (0)
+
+struct test_tpl {
+    struct rule_tpl tpl;
+    int val;
+};
+
+/* rbtree rules of a subtree, return its black height or -1 */
+static int check_rb_node(struct rb_node *node, struct rb_node *parent)
+{
+    int lh;
+    int rh;
+
+    if (NULL == node) {
+        return 1;
+    }
+    if (rb_parent(node) != parent) {
+        return -1;
+    }
+    if (rb_is_red(node) &&
+        ((node->rb_left && rb_is_red(node->rb_left)) ||
+         (node->rb_right && rb_is_red(node->rb_right)))) {
+        return -1;
+    }
+    lh = check_rb_node(node->rb_left, node);
+    rh = check_rb_node(node->rb_right, node);
+    if ((lh < 0) || (lh != rh)) {
+        return -1;
+    }
+    return lh + rb_is_black(node);
+}
+
+/* rbtree rules and id order of a rule table, return nodes or -1 */
+static long check_rule_table(struct rb_root *root)
+{
+    struct rb_node *node;
+    unsigned int last = 0;
+    long count = 0;
+
+    if ((root->rb_node && rb_is_red(root->rb_node)) ||
+        (check_rb_node(root->rb_node, NULL) < 0)) {
+        return -1;
+    }
+    /* bigger id first */
+    for (node = rb_first(root); node != NULL; node = rb_next(node)) {
+        if (count && (((struct rule_tpl *)node)->id >= last)) {
+            return -1;
+        }
+        last = ((struct rule_tpl *)node)->id;
+        count++;
+    }
+    return count;
+}
+
+struct test_pnode {
+    struct rule_tpl_pnode tpl;
+    int val;
+};
+
+/* same as check_rb_node, ids are kept in (lo, hi) */
+static int check_pnode(struct rb_pnode *node, long lo, long hi)
+{
+    long id;
+    int lh;
+    int rh;
+
+    if (NULL == node) {
+        return 1;
+    }
+    id = ((struct rule_tpl_pnode *)node)->id;
+    if ((id <= lo) || (id >= hi)) {
+        return -1;
+    }
+    if ((RB_RED == node->color) &&
+        ((node->rb_left && (RB_RED == node->rb_left->color)) ||
+         (node->rb_right && (RB_RED == node->rb_right->color)))) {
+        return -1;
+    }
+    lh = check_pnode(node->rb_left, id, hi);
+    rh = check_pnode(node->rb_right, lo, id);
+    if ((lh < 0) || (lh != rh)) {
+        return -1;
+    }
+    return lh + (RB_BLACK == node->color);
+}
+
+static void persist_test()
+{
+    struct rule_tpl_ptree tree;
+    struct rule_tpl_ptree snap;
+    struct test_pnode *p;
+    const struct test_pnode *q;
+    int i;
+
+    rule_tpl_ptree_init(&tree, sizeof(struct test_pnode));
+    for (i = 0; i < MODULE_NODES; i++) {
+        p = (struct test_pnode *)rule_tpl_ptree_create(&tree, i);
+        CHECK(p != NULL);
+        if (p) {
+            p->val = i;
+        }
+    }
+    CHECK(NULL == rule_tpl_ptree_create(&tree, 0));
+
+    /* the snapshot must not see the updates of the tree */
+    rule_tpl_ptree_snapshot(&tree, &snap);
+    for (i = 0; i < MODULE_NODES; i += 2) {
+        CHECK(0 == rule_tpl_ptree_delete(&tree, i));
+        p = (struct test_pnode *)rule_tpl_ptree_modify(&tree, i + 1);
+        CHECK(p != NULL);
+        if (p) {
+            p->val = -1;
+        }
+    }
+    CHECK(tree.count == MODULE_NODES / 2);
+    CHECK(snap.count == MODULE_NODES);
+    CHECK(check_pnode(tree.root, -1, MODULE_NODES) > 0);
+    CHECK(check_pnode(snap.root, -1, MODULE_NODES) > 0);
+    for (i = 0; i < MODULE_NODES; i++) {
+        q = (const struct test_pnode *)rule_tpl_ptree_search(&snap, i);
+        CHECK(q && (q->val == i));
+        q = (const struct test_pnode *)rule_tpl_ptree_search(&tree, i);
+        CHECK((i & 1) ? (q && (q->val == -1)) : (NULL == q));
+    }
+
+    rule_tpl_ptree_release(&snap);
+    rule_tpl_ptree_release(&tree);
+    printf("== persist test done\n");
+}
+
+static void image_test()
+{
+    const char *path = "/tmp/rbtree_sample.img";
+    struct rb_root root = RB_ROOT;
+    struct rule_tpl_image *img;
+    struct test_tpl *t;
+    FILE *fp;
+    int present;
+    int i;
+    int c;
+
+    for (i = 0; i < MODULE_NODES; i++) {
+        t = (struct test_tpl *)rule_tpl_create(&root, i,
+                                               sizeof(struct test_tpl));
+        if (t) {
+            t->val = i;
+        }
+    }
+    CHECK(0 == rule_tpl_image_save(&root, sizeof(struct test_tpl), path));
+    rule_tpl_tree_clear(&root, NULL);
+
+    img = rule_tpl_image_open(path, RB_IMAGE_RDONLY);
+    CHECK(img != NULL);
+    for (i = 0; img && (i < MODULE_NODES); i++) {
+        t = (struct test_tpl *)rule_tpl_image_search(img, i);
+        CHECK(t && (t->val == i));
+    }
+    rule_tpl_image_close(img, NULL);
+
+    /* updates of the private mapping, the file keeps all the ids */
+    img = rule_tpl_image_open(path, RB_IMAGE_COW);
+    CHECK(img != NULL);
+    for (i = 0; img && (i < MODULE_NODES); i += 2) {
+        CHECK(0 == rule_tpl_image_delete(img, i, NULL));
+        CHECK(rule_tpl_image_create(img, MODULE_NODES + i,
+                                    sizeof(struct test_tpl)) != NULL);
+    }
+    for (i = 0; img && (i < MODULE_NODES * 2); i++) {
+        t = (struct test_tpl *)rule_tpl_image_search(img, i);
+        present = (i < MODULE_NODES) ? (i & 1) : !(i & 1);
+        CHECK(!t == !present);
+    }
+    rule_tpl_image_close(img, NULL);
+
+    /* flip a byte of the last node, the crc must reject the file */
+    fp = fopen(path, "r+b");
+    CHECK(fp != NULL);
+    if (fp) {
+        fseek(fp, -1, SEEK_END);
+        c = fgetc(fp);
+        fseek(fp, -1, SEEK_END);
+        fputc(c ^ 0xff, fp);
+        fclose(fp);
+    }
+    CHECK(NULL == rule_tpl_image_open(path, RB_IMAGE_RDONLY));
+    unlink(path);
+    printf("== image test done\n");
+}
+
+struct test_shm {
+    struct rule_tpl_shm_node tpl;
+    int val;
+};
+
+static void shm_test()
+{
+    const char *name = "/rbtree_sample";
+    struct rule_tpl_shm *writer;
+    struct rule_tpl_shm *reader;
+    struct test_shm data;
+    int i;
+
+    rule_tpl_shm_unlink(name);
+    writer = rule_tpl_shm_open(name, sizeof(struct test_shm),
+                               MODULE_NODES, RB_SHM_CREATE);
+    reader = rule_tpl_shm_open(name, 0, 0, 0);
+    CHECK(writer && reader);
+    if ((NULL == writer) || (NULL == reader)) {
+        rule_tpl_shm_close(writer);
+        rule_tpl_shm_close(reader);
+        rule_tpl_shm_unlink(name);
+        return;
+    }
+
+    memset(&data, 0, sizeof(data));
+    for (i = 0; i < MODULE_NODES; i++) {
+        data.val = i;
+        CHECK(0 == rule_tpl_shm_create(writer, i, &data));
+    }
+    /* the segment is full */
+    CHECK(rule_tpl_shm_create(writer, MODULE_NODES, &data) != 0);
+    for (i = 0; i < MODULE_NODES; i += 2) {
+        CHECK(0 == rule_tpl_shm_delete(writer, i));
+        data.val = -1;
+        CHECK(0 == rule_tpl_shm_update(writer, i + 1, &data));
+    }
+
+    /* the reader has its own mapping of the segment */
+    for (i = 0; i < MODULE_NODES; i++) {
+        if (i & 1) {
+            CHECK((0 == rule_tpl_shm_lookup(reader, i, &data)) &&
+                  (data.tpl.id == i) && (data.val == -1));
+        }
+        else {
+            CHECK(rule_tpl_shm_lookup(reader, i, NULL) != 0);
+        }
+    }
+
+    rule_tpl_shm_close(reader);
+    rule_tpl_shm_close(writer);
+    rule_tpl_shm_unlink(name);
+    printf("== shm test done\n");
+}
+
+static void diff_test()
+{
+    struct rb_root old_root = RB_ROOT;
+    struct rb_root new_root = RB_ROOT;
+    struct rule_tpl_delta delta;
+    struct rb_node *a;
+    struct rb_node *b;
+    struct test_tpl *t;
+    int i;
+
+    for (i = 0; i < MODULE_NODES; i++) {
+        t = (struct test_tpl *)rule_tpl_create(&old_root, i,
+                                               sizeof(struct test_tpl));
+        if (t) {
+            t->val = i;
+        }
+        t = (struct test_tpl *)rule_tpl_create(&new_root,
+                    i + MODULE_NODES / 2, sizeof(struct test_tpl));
+        if (t) {
+            t->val = (i % 3) ? (i + MODULE_NODES / 2) : -1;
+        }
+    }
+
+    CHECK(0 == rule_tpl_delta_build(&old_root, &new_root,
+                                    sizeof(struct test_tpl), NULL, &delta));
+    CHECK(delta.added == MODULE_NODES / 2);
+    CHECK(delta.removed == MODULE_NODES / 2);
+    CHECK(delta.changed == (MODULE_NODES / 2 + 2) / 3);
+    CHECK(0 == rule_tpl_delta_apply(&old_root, &delta, NULL, NULL));
+    rule_tpl_delta_free(&delta);
+
+    /* the old table is now equal to the new one */
+    CHECK(check_rule_table(&old_root) == MODULE_NODES);
+    a = rb_first(&old_root);
+    b = rb_first(&new_root);
+    for (; a && b; a = rb_next(a), b = rb_next(b)) {
+        CHECK(((struct test_tpl *)a)->tpl.id == ((struct test_tpl *)b)->tpl.id);
+        CHECK(((struct test_tpl *)a)->val == ((struct test_tpl *)b)->val);
+    }
+    CHECK((NULL == a) && (NULL == b));
+
+    rule_tpl_tree_clear(&old_root, NULL);
+    rule_tpl_tree_clear(&new_root, NULL);
+    printf("== diff test done\n");
+}
+
+static void hash_test()
+{
+    struct rule_tpl_htable *ht;
+    struct test_tpl *t;
+    int i;
+
+    /* small capacity, the index has to grow */
+    ht = rule_tpl_htable_alloc(sizeof(struct test_tpl), 16);
+    CHECK(ht != NULL);
+    if (NULL == ht) {
+        return;
+    }
+
+    for (i = 0; i < MODULE_NODES; i++) {
+        t = (struct test_tpl *)rule_tpl_htable_create(ht, i * 7);
+        CHECK(t != NULL);
+        if (t) {
+            t->val = i;
+        }
+    }
+    CHECK(NULL == rule_tpl_htable_create(ht, 0));
+    for (i = 0; i < MODULE_NODES; i += 2) {
+        CHECK(0 == rule_tpl_htable_delete(ht, i * 7, NULL));
+    }
+
+    /* the index and the tree must agree */
+    CHECK(ht->count == MODULE_NODES / 2);
+    CHECK(check_rule_table(&ht->root) == MODULE_NODES / 2);
+    for (i = 0; i < MODULE_NODES * 7; i++) {
+        t = (struct test_tpl *)rule_tpl_htable_search(ht, i);
+        CHECK(t == rule_tpl_search(&ht->root, i));
+        if (0 == i % 7) {
+            CHECK((i / 7 & 1) ? (t && (t->val == i / 7)) : (NULL == t));
+        }
+    }
+
+    rule_tpl_htable_free(ht, NULL);
+    printf("== hash test done\n");
+}
+
+static void bloom_test()
+{
+    struct rb_root root = RB_ROOT;
+    struct rb_bloom *bloom;
+    int positive = 0;
+    int i;
+
+    bloom = rb_bloom_create(MODULE_NODES, 0);
+    CHECK(bloom != NULL);
+    if (NULL == bloom) {
+        return;
+    }
+
+    for (i = 0; i < MODULE_NODES; i++) {
+        CHECK(rule_tpl_bloom_create(&root, i, sizeof(struct test_tpl),
+                                    bloom) != NULL);
+    }
+    for (i = 0; i < MODULE_NODES; i += 2) {
+        CHECK(0 == rule_tpl_bloom_delete(&root, i, NULL, bloom));
+    }
+
+    /* no false negative after the deletes */
+    for (i = 0; i < MODULE_NODES; i++) {
+        CHECK(!rule_tpl_bloom_search(&root, i, bloom) == !(i & 1));
+    }
+    /* the default is about 1% of false positives */
+    for (i = MODULE_NODES; i < MODULE_NODES * 11; i++) {
+        positive += rb_bloom_may_contain(bloom, i);
+    }
+    CHECK(positive < MODULE_NODES / 2);
+
+    rule_tpl_tree_clear(&root, NULL);
+    rb_bloom_destroy(bloom);
+    printf("== bloom test done\n");
+}
+
+/* same as check_pnode, for the compact nodes */
+static int check_tnode(struct rb_tnode *node, long lo, long hi)
+{
+    struct rb_tnode *left;
+    long id;
+    int lh;
+    int rh;
+
+    if (NULL == node) {
+        return 1;
+    }
+    id = ((struct rule_ttpl *)node)->id;
+    if ((id <= lo) || (id >= hi)) {
+        return -1;
+    }
+    left = rb_td_left(node);
+    if (rb_td_is_red(node) &&
+        (rb_td_is_red(left) || rb_td_is_red(node->rb_right))) {
+        return -1;
+    }
+    lh = check_tnode(left, id, hi);
+    rh = check_tnode(node->rb_right, lo, id);
+    if ((lh < 0) || (lh != rh)) {
+        return -1;
+    }
+    return lh + !rb_td_is_red(node);
+}
+
+static void topdown_test()
+{
+    struct rb_troot root = RB_TROOT;
+    struct rb_td_iter it;
+    struct rb_tnode *node;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < MODULE_NODES; i++) {
+        CHECK(rule_ttpl_create(&root, (i * 37) % MODULE_NODES,
+                               sizeof(struct rule_ttpl)) != NULL);
+    }
+    CHECK(NULL == rule_ttpl_create(&root, 0, sizeof(struct rule_ttpl)));
+    for (i = 0; i < MODULE_NODES; i += 2) {
+        CHECK(0 == rule_ttpl_delete(&root, i, NULL));
+    }
+    CHECK(rule_ttpl_delete(&root, 0, NULL) != 0);
+
+    CHECK(!rb_td_is_red(root.rb_node));
+    CHECK(check_tnode(root.rb_node, -1, MODULE_NODES) > 0);
+    for (node = rb_td_first(&it, &root); node; node = rb_td_next(&it)) {
+        CHECK(((struct rule_ttpl *)node)->id == MODULE_NODES - 1 - 2 * count);
+        count++;
+    }
+    CHECK(count == MODULE_NODES / 2);
+    for (i = 0; i < MODULE_NODES; i++) {
+        CHECK(!rule_ttpl_search(&root, i) == !(i & 1));
+    }
+
+    rule_ttpl_tree_clear(&root, NULL);
+    printf("== top down test done\n");
+}
+
+struct test_timer {
+    struct rb_timer timer;
+    unsigned long fired;    /* tick of the expiry */
+    int hits;
+};
+
+static void test_timer_fn(struct rb_timer *timer, void *arg)
+{
+    struct test_timer *t = (struct test_timer *)timer;
+
+    /* the base is already on the next tick */
+    t->fired = ((struct rb_timer_base *)arg)->jiffies - 1;
+    t->hits++;
+}
+
+static void timer_test()
+{
+    struct test_timer timers[64];
+    struct rb_timer_base *base;
+    unsigned long expires;
+    unsigned long last = 0;
+    unsigned long armed = 0;
+    int i;
+
+    base = rb_timer_base_alloc(0);
+    CHECK(base != NULL);
+    if (NULL == base) {
+        return;
+    }
+
+    /* up to 64^3 * 97 ticks, the last ones beyond the wheel */
+    memset(timers, 0, sizeof(timers));
+    for (i = 0; i < 64; i++) {
+        rb_timer_init(&timers[i].timer);
+        CHECK(0 == rb_timer_add(base, &timers[i].timer,
+                                (unsigned long)i * i * i * 97));
+    }
+    CHECK(rb_timer_add(base, &timers[0].timer, 1) != 0);
+    for (i = 0; i < 64; i++) {
+        if (0 == i % 5) {
+            CHECK(0 == rb_timer_del(base, &timers[i].timer));
+        }
+        else if (0 == i % 3) {
+            rb_timer_mod(base, &timers[i].timer,
+                         timers[i].timer.expires + 1000);
+        }
+    }
+    for (i = 0; i < 64; i++) {
+        if (rb_timer_pending(&timers[i].timer)) {
+            armed++;
+            if (timers[i].timer.expires > last) {
+                last = timers[i].timer.expires;
+            }
+        }
+    }
+
+    CHECK(rb_timer_expire(base, last, test_timer_fn, base) == armed);
+    for (i = 0; i < 64; i++) {
+        expires = (unsigned long)i * i * i * 97 + ((i % 3) ? 0 : 1000);
+        if (0 == i % 5) {
+            CHECK(0 == timers[i].hits);
+        }
+        else {
+            CHECK((1 == timers[i].hits) && (timers[i].fired == expires));
+        }
+        CHECK(!rb_timer_pending(&timers[i].timer));
+    }
+
+    rb_timer_base_free(base);
+    printf("== timer test done\n");
+}
+
+void module_test()
+{
+    printf("---------------------Module test---------------------------\n");
+    persist_test();
+    image_test();
+    shm_test();
+    diff_test();
+    hash_test();
+    bloom_test();
+    topdown_test();
+    timer_test();
+    printf("== %d check(s) failed\n", check_failed);
+}
+
 int main(int argc, char *argv[])
 {
     if (!(progname = strrchr(argv[0], '/'))) {
@@ -317,9 +849,10 @@ int main(int argc, char *argv[])
         test_data_build(1);
         func_test();
         test_data_free();
+        module_test();
     }
     else {
         perf_test();
     }
-    return 0;
+    return check_failed ? 1 : 0;
 }
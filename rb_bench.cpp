@@ -0,0 +1,155 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* rb::map against std::map, same keys, same operations.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+#include "rbtree.hpp"
+
+/* node number, default 1M */
+static int nodes_num = 1000000;
+
+/* loop counts, default 3 */
+static int bench_loops = 3;
+
+static char *progname;
+
+struct bench_result {
+    double          insert_ns;
+    double          find_ns;
+    double          iter_ns;
+    double          erase_ns;
+    unsigned long   check;      /* must match between the maps */
+};
+
+static inline double elapsed_ns(std::chrono::steady_clock::time_point start,
+                                int ops)
+{
+    std::chrono::duration<double, std::nano> d =
+        std::chrono::steady_clock::now() - start;
+    return d.count() / ops;
+}
+
+template <class Map>
+static void bench_map(const std::vector<unsigned int> &keys,
+                      const std::vector<unsigned int> &lookups,
+                      struct bench_result *res)
+{
+    Map m;
+    unsigned long check = 0;
+    int n = (int)keys.size();
+    int i;
+
+    std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    for (i = 0; i < n; i++) {
+        m.emplace(keys[i], (unsigned long)keys[i] * 3);
+    }
+    res->insert_ns = elapsed_ns(t, n);
+
+    t = std::chrono::steady_clock::now();
+    for (i = 0; i < n; i++) {
+        typename Map::iterator it = m.find(lookups[i]);
+        if (it != m.end()) {
+            check += it->second;
+        }
+    }
+    res->find_ns = elapsed_ns(t, n);
+
+    t = std::chrono::steady_clock::now();
+    for (typename Map::iterator it = m.begin(); it != m.end(); ++it) {
+        check ^= it->first;
+    }
+    res->iter_ns = elapsed_ns(t, n);
+
+    t = std::chrono::steady_clock::now();
+    for (i = 0; i < n; i++) {
+        m.erase(keys[i]);
+    }
+    res->erase_ns = elapsed_ns(t, n);
+
+    res->check = check + m.size();
+}
+
+static void usage()
+{
+    printf(("\n  Usage:"
+            "\n    %s [-n nodes] [-l loops]"
+            "\n      -n : node number, default 1000000"
+            "\n      -l : loop counts, default 3\n\n"), progname);
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_result rb_res;
+    struct bench_result std_res;
+    int opt;
+    int i;
+
+    progname = argv[0];
+    while ((opt = getopt(argc, argv, "n:l:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            nodes_num = atoi(optarg);
+            break;
+        case 'l':
+            bench_loops = atoi(optarg);
+            break;
+        default:
+            usage();
+            return 0;
+        }
+    }
+    if ((nodes_num <= 0) || (bench_loops <= 0)) {
+        usage();
+        return -1;
+    }
+
+    /* half of the lookups miss */
+    std::mt19937 gen(2019);
+    std::vector<unsigned int> keys(nodes_num);
+    std::vector<unsigned int> lookups(nodes_num);
+    for (i = 0; i < nodes_num; i++) {
+        keys[i] = (unsigned int)i * 2;
+        lookups[i] = (unsigned int)(gen() % ((unsigned int)nodes_num * 2));
+    }
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    printf("-----------------------------------------------------------\n");
+    printf("              rb::map vs std::map benchmark                \n");
+    printf("      nodes number :     %d \n", nodes_num);
+    printf("      loops        :     %d \n", bench_loops);
+    printf("-----------------------------------------------------------\n");
+    printf("        ns/op      insert     find     iter    erase\n");
+
+    for (i = 0; i < bench_loops; i++) {
+        bench_map<rb::map<unsigned int, unsigned long> >(keys, lookups,
+                                                         &rb_res);
+        bench_map<std::map<unsigned int, unsigned long> >(keys, lookups,
+                                                          &std_res);
+        if (rb_res.check != std_res.check) {
+            printf("check mismatch, rb:%lu std:%lu\n",
+                   rb_res.check, std_res.check);
+            return -1;
+        }
+        printf("[%d] rb::map   %8.1f %8.1f %8.1f %8.1f\n", i,
+               rb_res.insert_ns, rb_res.find_ns, rb_res.iter_ns,
+               rb_res.erase_ns);
+        printf("[%d] std::map  %8.1f %8.1f %8.1f %8.1f\n", i,
+               std_res.insert_ns, std_res.find_ns, std_res.iter_ns,
+               std_res.erase_ns);
+    }
+    printf("-----------------------------------------------------------\n");
+    return 0;
+}
@@ -0,0 +1,184 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Blocked counting bloom filter guard of rule tables.
+ */
+#include "rb_bloom.h"
+
+#define RB_BLOOM_K_MAX      8
+
+struct rb_bloom *rb_bloom_create(unsigned long capacity,
+            unsigned int bits_per_id)
+{
+    struct rb_bloom *bloom;
+    unsigned long bits;
+    unsigned long nr_blocks = 1;
+
+    if (0 == bits_per_id) {
+        bits_per_id = RB_BLOOM_BITS_PER_ID;
+    }
+    if (0 == capacity) {
+        capacity = 1;
+    }
+
+    bits = capacity * bits_per_id;
+    while (nr_blocks * RB_BLOOM_COUNTERS < bits) {
+        nr_blocks <<= 1;
+    }
+
+    bloom = (struct rb_bloom *)malloc(sizeof(*bloom));
+    if (NULL == bloom) {
+        return NULL;
+    }
+    memset(bloom, 0, sizeof(*bloom));
+
+    if (posix_memalign((void **)&bloom->blocks, RB_BLOOM_BLOCK,
+                       nr_blocks * sizeof(struct rb_bloom_block)) != 0) {
+        free(bloom);
+        return NULL;
+    }
+    memset(bloom->blocks, 0, nr_blocks * sizeof(struct rb_bloom_block));
+    bloom->nr_blocks = nr_blocks;
+
+    /* k = ln2 * bits per id, blocking costs a little, so round down */
+    bloom->k = bits_per_id * 69 / 100;
+    if (bloom->k < 1) {
+        bloom->k = 1;
+    }
+    else if (bloom->k > RB_BLOOM_K_MAX) {
+        bloom->k = RB_BLOOM_K_MAX;
+    }
+    return bloom;
+}
+
+void rb_bloom_destroy(struct rb_bloom *bloom)
+{
+    if (NULL == bloom) {
+        return;
+    }
+
+    free(bloom->blocks);
+    free(bloom);
+}
+
+static struct rb_bloom_block *rb_bloom_locate(struct rb_bloom *bloom,
+            unsigned int id, uint64_t *g)
+{
+    uint64_t h = rb_bloom_hash(id);
+
+    *g = rb_bloom_probes(h);
+    return &bloom->blocks[h & (bloom->nr_blocks - 1)];
+}
+
+void rb_bloom_add(struct rb_bloom *bloom, unsigned int id)
+{
+    struct rb_bloom_block *block;
+    uint64_t g;
+    unsigned int idx, i;
+    int c;
+
+    if (NULL == bloom) {
+        return;
+    }
+
+    block = rb_bloom_locate(bloom, id, &g);
+    for (i = 0; i < bloom->k; i++) {
+        idx = RB_BLOOM_PROBE(g, i);
+        c = rb_bloom_counter(block, idx);
+        if (c == RB_BLOOM_COUNTER_MAX) {
+            continue;
+        }
+        block->word[idx >> 4] += 1ULL << ((idx & 15) * 4);
+        if (c + 1 == RB_BLOOM_COUNTER_MAX) {
+            bloom->saturated++;
+        }
+    }
+    bloom->ids++;
+}
+
+void rb_bloom_del(struct rb_bloom *bloom, unsigned int id)
+{
+    struct rb_bloom_block *block;
+    uint64_t g;
+    unsigned int idx, i;
+    int c;
+
+    if ((NULL == bloom) || (0 == bloom->ids)) {
+        return;
+    }
+
+    block = rb_bloom_locate(bloom, id, &g);
+    for (i = 0; i < bloom->k; i++) {
+        idx = RB_BLOOM_PROBE(g, i);
+        c = rb_bloom_counter(block, idx);
+        /* a saturated counter lost its count, keep it */
+        if ((c == 0) || (c == RB_BLOOM_COUNTER_MAX)) {
+            continue;
+        }
+        block->word[idx >> 4] -= 1ULL << ((idx & 15) * 4);
+    }
+    bloom->ids--;
+}
+
+int rb_bloom_rebuild(struct rb_bloom *bloom, struct rb_root *root)
+{
+    struct rb_node *node;
+
+    if ((NULL == bloom) || (NULL == root)) {
+        return -1;
+    }
+
+    memset(bloom->blocks, 0, bloom->nr_blocks * sizeof(struct rb_bloom_block));
+    bloom->ids = 0;
+    bloom->saturated = 0;
+    for (node = rb_first(root); node; node = rb_next(node)) {
+        rb_bloom_add(bloom, container_of(node, struct rule_tpl, node)->id);
+    }
+    return 0;
+}
+
+void rb_bloom_stats(const struct rb_bloom *bloom, struct rb_bloom_stats *stats)
+{
+    const struct rb_bloom_block *block;
+    unsigned long b;
+    unsigned int idx, i, used;
+    double fill, p, sum = 0;
+
+    if ((NULL == bloom) || (NULL == stats)) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    stats->mem_bytes = sizeof(*bloom) +
+                       bloom->nr_blocks * sizeof(struct rb_bloom_block);
+    stats->nr_blocks = bloom->nr_blocks;
+    stats->k = bloom->k;
+    stats->ids = bloom->ids;
+    stats->saturated = bloom->saturated;
+
+    /*
+      an absent id hits a random block and passes if all its k counters
+      are in use there, so the rate is the mean of fill^k over blocks.
+     */
+    for (b = 0; b < bloom->nr_blocks; b++) {
+        block = &bloom->blocks[b];
+        used = 0;
+        for (idx = 0; idx < RB_BLOOM_COUNTERS; idx++) {
+            if (rb_bloom_counter(block, idx)) {
+                used++;
+            }
+        }
+        fill = (double)used / RB_BLOOM_COUNTERS;
+        p = 1;
+        for (i = 0; i < bloom->k; i++) {
+            p *= fill;
+        }
+        sum += p;
+    }
+    stats->fp_rate = sum / bloom->nr_blocks;
+}
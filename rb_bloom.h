@@ -0,0 +1,182 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_BLOOM_H
+#define	___RB_BLOOM_H
+
+#include <stdint.h>
+#include "rbtree.h"
+
+/*
+  blocked counting bloom filter
+  A guard in front of a rule table whose lookups mostly miss. All the
+  counters of one id are in a single 64 byte block, so an absent id is
+  rejected with one cache line probe before the tree is touched.
+  The counters are 4 bits, so delete is supported. A counter that
+  reaches 15 sticks there and is never decremented, which may only add
+  false positives, never false negatives.
+  The filter is not thread safe, same as the rule tables, but lookups
+  only read it: concurrent readers share the blocks without writing
+  any cache line.
+ */
+#define RB_BLOOM_BLOCK          64  /* bytes, one cache line */
+#define RB_BLOOM_BLOCK_WORDS    (RB_BLOOM_BLOCK / sizeof(uint64_t))
+#define RB_BLOOM_COUNTERS       (RB_BLOOM_BLOCK * 2)
+#define RB_BLOOM_COUNTER_MAX    15
+#define RB_BLOOM_BITS_PER_ID    10  /* default, about 1% false positives */
+
+struct rb_bloom_block {
+    uint64_t            word[RB_BLOOM_BLOCK_WORDS];
+} __attribute__((aligned(RB_BLOOM_BLOCK)));
+
+struct rb_bloom {
+    struct rb_bloom_block  *blocks;
+    unsigned long           nr_blocks;  /* power of 2 */
+    unsigned int            k;          /* counters per id */
+    unsigned long           ids;        /* ids in the filter */
+    unsigned long           saturated;  /* counters stuck at max */
+};
+
+struct rb_bloom_stats {
+    unsigned long  mem_bytes;       /* blocks and struct */
+    unsigned long  nr_blocks;
+    unsigned int   k;
+    unsigned long  ids;
+    unsigned long  saturated;
+    double         fp_rate;         /* estimated from the counters in use */
+};
+
+/*
+  bloom filter create function
+  capacity    : the expected number of ids in the table
+  bits_per_id : filter bits per id (each bit is a 4 bit counter in
+                memory), 0 for the default
+ */
+extern struct rb_bloom *rb_bloom_create(unsigned long capacity,
+            unsigned int bits_per_id);
+extern void rb_bloom_destroy(struct rb_bloom *bloom);
+extern void rb_bloom_add(struct rb_bloom *bloom, unsigned int id);
+/* id must have been added, else other ids may be lost */
+extern void rb_bloom_del(struct rb_bloom *bloom, unsigned int id);
+/* forget all the ids and add the ones of the table */
+extern int rb_bloom_rebuild(struct rb_bloom *bloom, struct rb_root *root);
+extern void rb_bloom_stats(const struct rb_bloom *bloom,
+            struct rb_bloom_stats *stats);
+
+/* the hash of an id, the low bits pick the block */
+static inline uint64_t rb_bloom_hash(unsigned int id)
+{
+    uint64_t h = id;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+  the probes of an id, 7 bits each from the top of a second mix.
+  Double hashing (h1 + i * h2) is no good inside a 128 counter block,
+  ids of close h1 share most of their counters.
+ */
+static inline uint64_t rb_bloom_probes(uint64_t h)
+{
+    return (h ^ (h >> 32)) * 0x9e3779b97f4a7c15ULL;
+}
+
+#define RB_BLOOM_PROBE(g, i)    ((unsigned int)((g) >> (57 - 7 * (i))) & \
+                                 (RB_BLOOM_COUNTERS - 1))
+
+static inline int rb_bloom_counter(const struct rb_bloom_block *block,
+                                   unsigned int idx)
+{
+    return (int)((block->word[idx >> 4] >> ((idx & 15) * 4)) & 0xf);
+}
+
+/* 0 if the id is surely absent, 1 if it may be present */
+static inline int
+rb_bloom_may_contain(const struct rb_bloom *bloom, unsigned int id)
+{
+    const struct rb_bloom_block *block;
+    uint64_t h = rb_bloom_hash(id);
+    uint64_t g = rb_bloom_probes(h);
+    unsigned int i;
+
+    block = &bloom->blocks[h & (bloom->nr_blocks - 1)];
+    for (i = 0; i < bloom->k; i++) {
+        if (rb_bloom_counter(block, RB_BLOOM_PROBE(g, i)) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+  rule templet create function, the id is added to the filter.
+  root : the rb_root of actual table to be insert.
+  id   : the id of actual table
+  size : the size of actual table, must be more than sizeof(struct rule_tpl)
+  bloom: the filter of the table
+ */
+static inline void *
+rule_tpl_bloom_create(struct rb_root *root, unsigned int id,
+                      unsigned long size, struct rb_bloom *bloom)
+{
+    void *tpl;
+
+    if (NULL == bloom) {
+        return NULL;
+    }
+
+    tpl = rule_tpl_create(root, id, size);
+    if (tpl) {
+        rb_bloom_add(bloom, id);
+    }
+    return tpl;
+}
+
+/*
+  rule templet delete function, the id is removed from the filter.
+  root : the rb_root of actual table to be remove.
+  id   : the id of actual table
+ */
+static inline int
+rule_tpl_bloom_delete(struct rb_root *root, unsigned int id,
+                      TPL_FREE tpl_free, struct rb_bloom *bloom)
+{
+    if (NULL == bloom) {
+        return -1;
+    }
+
+    if (rule_tpl_delete(root, id, tpl_free) != 0) {
+        return -1;
+    }
+    rb_bloom_del(bloom, id);
+    return 0;
+}
+
+/*
+  rule templet search function, the tree is searched only if the
+  filter may contain the id.
+  root : the rb_root of actual table
+  id   : the id of actual table
+ */
+static inline void *
+rule_tpl_bloom_search(struct rb_root *root, unsigned int id,
+                      const struct rb_bloom *bloom)
+{
+    if ((NULL == bloom) || !rb_bloom_may_contain(bloom, id)) {
+        return NULL;
+    }
+
+    return rule_tpl_search(root, id);
+}
+
+#endif	/* ___RB_BLOOM_H */
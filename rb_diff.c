@@ -0,0 +1,253 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Linear time diff of two ordered trees, and rule table delta push.
+ */
+#include "rb_diff.h"
+
+int rb_diff(struct rb_root *old_root, struct rb_root *new_root,
+            RB_NODE_COMPARE order, RB_NODE_COMPARE payload_cmp,
+            RB_DIFF_CB cb, void *arg)
+{
+    struct rb_node *o;
+    struct rb_node *n;
+    int delta;
+
+    if ((NULL == old_root) || (NULL == new_root) ||
+        (NULL == order) || (NULL == cb)) {
+        return -1;
+    }
+
+    o = rb_first(old_root);
+    n = rb_first(new_root);
+    while (o || n) {
+        if (NULL == o) {
+            delta = 1;
+        }
+        else if (NULL == n) {
+            delta = -1;
+        }
+        else {
+            delta = order(o, n);
+        }
+
+        if (delta < 0) {
+            cb(arg, RB_DIFF_REMOVED, o, NULL);
+            o = rb_next(o);
+        }
+        else if (delta > 0) {
+            cb(arg, RB_DIFF_ADDED, NULL, n);
+            n = rb_next(n);
+        }
+        else {
+            if ((NULL == payload_cmp) || (payload_cmp(o, n) != 0)) {
+                cb(arg, RB_DIFF_CHANGED, o, n);
+            }
+            o = rb_next(o);
+            n = rb_next(n);
+        }
+    }
+    return 0;
+}
+
+/* tree order of rule_tpl tables, bigger id first */
+static int rule_tpl_order(struct rb_node *a, struct rb_node *b)
+{
+    unsigned int ida = container_of(a, struct rule_tpl, node)->id;
+    unsigned int idb = container_of(b, struct rule_tpl, node)->id;
+
+    if (ida > idb) {
+        return -1;
+    }
+    else if (ida < idb) {
+        return 1;
+    }
+    return 0;
+}
+
+struct rule_tpl_diff_ctx {
+    struct rule_tpl_delta   *delta;
+    RB_NODE_COMPARE          payload_cmp;
+    int                      err;
+};
+
+static void rule_tpl_diff_cb(void *arg, int kind, struct rb_node *old,
+            struct rb_node *new_node)
+{
+    struct rule_tpl_diff_ctx *ctx = (struct rule_tpl_diff_ctx *)arg;
+    struct rule_tpl_delta *delta = ctx->delta;
+    struct rule_tpl_delta_entry *entry;
+
+    if (ctx->err) {
+        return;
+    }
+
+    if (kind == RB_DIFF_CHANGED) {
+        if (ctx->payload_cmp) {
+            if (ctx->payload_cmp(old, new_node) == 0) {
+                return;
+            }
+        }
+        else if (memcmp((char *)old + sizeof(struct rule_tpl),
+                        (char *)new_node + sizeof(struct rule_tpl),
+                        delta->size - sizeof(struct rule_tpl)) == 0) {
+            return;
+        }
+    }
+
+    if (delta->count == delta->max) {
+        unsigned long max = delta->max ? delta->max * 2 : 64;
+        entry = (struct rule_tpl_delta_entry *)
+            realloc(delta->entries, max * sizeof(*entry));
+        if (NULL == entry) {
+            ctx->err = -1;
+            return;
+        }
+        delta->entries = entry;
+        delta->max = max;
+    }
+
+    entry = &delta->entries[delta->count++];
+    entry->kind = kind;
+    if (kind == RB_DIFF_REMOVED) {
+        entry->id = container_of(old, struct rule_tpl, node)->id;
+        entry->src = NULL;
+        delta->removed++;
+    }
+    else {
+        entry->src = container_of(new_node, struct rule_tpl, node);
+        entry->id = entry->src->id;
+        if (kind == RB_DIFF_ADDED) {
+            delta->added++;
+        }
+        else {
+            delta->changed++;
+        }
+    }
+}
+
+int rule_tpl_delta_build(struct rb_root *old_root,
+            struct rb_root *new_root, unsigned long size,
+            RB_NODE_COMPARE payload_cmp, struct rule_tpl_delta *delta)
+{
+    struct rule_tpl_diff_ctx ctx;
+
+    if ((NULL == delta) || (size < sizeof(struct rule_tpl))) {
+        return -1;
+    }
+
+    memset(delta, 0, sizeof(*delta));
+    delta->size = size;
+    ctx.delta = delta;
+    ctx.payload_cmp = payload_cmp;
+    ctx.err = 0;
+
+    /* rule_tpl_diff_cb has the size for the default memcmp */
+    if ((rb_diff(old_root, new_root, rule_tpl_order, NULL,
+                 rule_tpl_diff_cb, &ctx) != 0) || ctx.err) {
+        rule_tpl_delta_free(delta);
+        return -1;
+    }
+    return 0;
+}
+
+int rule_tpl_delta_apply(struct rb_root *live,
+            const struct rule_tpl_delta *delta, TPL_COPY tpl_copy,
+            TPL_FREE tpl_free)
+{
+    const struct rule_tpl_delta_entry *entry;
+    struct rule_tpl *finger = NULL;
+    struct rule_tpl *tpl;
+    struct rb_node *next;
+    unsigned long payload;
+    unsigned long i;
+    int ret = 0;
+
+    if ((NULL == live) || (NULL == delta)) {
+        return -1;
+    }
+
+    /* the entries are in tree order, each search starts from the last one */
+    payload = delta->size - sizeof(struct rule_tpl);
+    for (i = 0; i < delta->count; i++) {
+        entry = &delta->entries[i];
+        switch (entry->kind) {
+        case RB_DIFF_REMOVED:
+            tpl = (struct rule_tpl *)
+                rule_tpl_finger_search(live, finger, entry->id);
+            if (NULL == tpl) {
+                ret = -1;
+                break;
+            }
+            next = rb_next(&tpl->node);
+            if (NULL == next) {
+                next = rb_prev(&tpl->node);
+            }
+            finger = next ? container_of(next, struct rule_tpl, node) : NULL;
+            rb_erase(&tpl->node, live);
+            if (tpl_free) {
+                tpl_free(&tpl->node);
+            }
+            free((void *)tpl);
+            break;
+        case RB_DIFF_ADDED:
+            tpl = (struct rule_tpl *)malloc(delta->size);
+            if (NULL == tpl) {
+                ret = -1;
+                break;
+            }
+            memset(tpl, 0, sizeof(struct rule_tpl));
+            tpl->id = entry->id;
+            memcpy((char *)tpl + sizeof(struct rule_tpl),
+                   (char *)entry->src + sizeof(struct rule_tpl), payload);
+            if (rule_tpl_finger_insert(live, finger, tpl) != 0) {
+                free(tpl);
+                ret = -1;
+                break;
+            }
+            if (tpl_copy) {
+                tpl_copy(&tpl->node, &entry->src->node);
+            }
+            finger = tpl;
+            break;
+        case RB_DIFF_CHANGED:
+            tpl = (struct rule_tpl *)
+                rule_tpl_finger_search(live, finger, entry->id);
+            if (NULL == tpl) {
+                ret = -1;
+                break;
+            }
+            if (tpl_free) {
+                tpl_free(&tpl->node);
+            }
+            memcpy((char *)tpl + sizeof(struct rule_tpl),
+                   (char *)entry->src + sizeof(struct rule_tpl), payload);
+            if (tpl_copy) {
+                tpl_copy(&tpl->node, &entry->src->node);
+            }
+            finger = tpl;
+            break;
+        default:
+            ret = -1;
+            break;
+        }
+    }
+    return ret;
+}
+
+void rule_tpl_delta_free(struct rule_tpl_delta *delta)
+{
+    if (NULL == delta) {
+        return;
+    }
+
+    free(delta->entries);
+    delta->entries = NULL;
+    delta->count = 0;
+    delta->max = 0;
+}
@@ -0,0 +1,85 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_DIFF_H
+#define	___RB_DIFF_H
+
+#include "rbtree.h"
+
+/*
+  ordered diff of two trees
+  Both trees are walked in lockstep with rb_next, O(n + m), instead of
+  searching every node of one tree in the other one.
+ */
+#define RB_DIFF_ADDED       1   /* only in the new tree */
+#define RB_DIFF_REMOVED     2   /* only in the old tree */
+#define RB_DIFF_CHANGED     3   /* in both, payload differs */
+
+/* tree order of two nodes, <0 if a is before b */
+typedef int (*RB_NODE_COMPARE)(struct rb_node *a, struct rb_node *b);
+/* old or new is NULL for ADDED and REMOVED */
+typedef void (*RB_DIFF_CB)(void *arg, int kind, struct rb_node *old,
+            struct rb_node *new_node);
+
+/*
+  old/new_root: the trees to compare
+  order       : tree order of the nodes
+  payload_cmp : 0 if two nodes of the same key are equal, NULL to pass
+                every common pair to cb as CHANGED, cb compares them
+  cb          : called for every difference, in tree order
+ */
+extern int rb_diff(struct rb_root *old_root, struct rb_root *new_root,
+            RB_NODE_COMPARE order, RB_NODE_COMPARE payload_cmp,
+            RB_DIFF_CB cb, void *arg);
+
+/*
+  rule table delta
+  The entries point to the nodes of the new table, which must be kept
+  until the delta is applied.
+ */
+struct rule_tpl_delta_entry {
+    int                  kind;
+    unsigned int         id;
+    struct rule_tpl     *src;   /* new node, NULL for REMOVED */
+};
+
+struct rule_tpl_delta {
+    unsigned long                size;      /* size of actual table */
+    unsigned long                count;
+    unsigned long                max;
+    unsigned long                added;
+    unsigned long                removed;
+    unsigned long                changed;
+    struct rule_tpl_delta_entry *entries;   /* in tree order */
+};
+
+/*
+  rule templet diff function
+  size       : the size of actual table, the payload after struct rule_tpl
+               is compared with memcmp when payload_cmp is NULL
+ */
+extern int rule_tpl_delta_build(struct rb_root *old_root,
+            struct rb_root *new_root, unsigned long size,
+            RB_NODE_COMPARE payload_cmp, struct rule_tpl_delta *delta);
+
+/*
+  apply the delta to a live table in one batch, live is usually the old
+  table of the diff. The entries are in tree order, so every lookup
+  starts from the node of the previous one.
+  The payload of an added or changed node is a byte copy of the new
+  node: tpl_copy, if not NULL, is called on it to make it own its own
+  resources, otherwise it shares them with the new table. tpl_free is
+  called for the removed nodes and on the changed nodes before their
+  payload is overwritten.
+ */
+extern int rule_tpl_delta_apply(struct rb_root *live,
+            const struct rule_tpl_delta *delta, TPL_COPY tpl_copy,
+            TPL_FREE tpl_free);
+extern void rule_tpl_delta_free(struct rule_tpl_delta *delta);
+
+#endif	/* ___RB_DIFF_H */
@@ -0,0 +1,261 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Flat combining front end of the rule table.
+ */
+#include "rb_fc.h"
+
+static inline void rb_fc_relax(void)
+{
+	asm volatile("pause" ::: "memory");
+}
+
+struct rule_tpl_fc *rule_tpl_fc_alloc(unsigned long size,
+            int max_threads, TPL_FREE tpl_free)
+{
+    struct rule_tpl_fc *fc;
+
+    if ((size < sizeof(struct rule_tpl)) || (max_threads <= 0)) {
+        return NULL;
+    }
+
+    fc = (struct rule_tpl_fc *)malloc(sizeof(*fc));
+    if (NULL == fc) {
+        return NULL;
+    }
+    memset(fc, 0, sizeof(*fc));
+    fc->root = RB_ROOT;
+    fc->size = size;
+    fc->tpl_free = tpl_free;
+    fc->nr_slots = max_threads;
+
+    if (posix_memalign((void **)&fc->slots, 64,
+                       max_threads * sizeof(*fc->slots)) != 0) {
+        free(fc);
+        return NULL;
+    }
+    memset(fc->slots, 0, max_threads * sizeof(*fc->slots));
+
+    fc->batch = (struct rule_tpl_fc_slot **)
+        malloc(max_threads * sizeof(*fc->batch));
+    if (NULL == fc->batch) {
+        free(fc->slots);
+        free(fc);
+        return NULL;
+    }
+    return fc;
+}
+
+void rule_tpl_fc_free(struct rule_tpl_fc *fc)
+{
+    if (NULL == fc) {
+        return;
+    }
+
+    rule_tpl_tree_clear(&fc->root, fc->tpl_free);
+    free(fc->batch);
+    free(fc->slots);
+    free(fc);
+}
+
+struct rule_tpl_fc_slot *rule_tpl_fc_slot_get(struct rule_tpl_fc *fc)
+{
+    int used;
+    int i;
+
+    if (NULL == fc) {
+        return NULL;
+    }
+
+    for (i = 0; i < fc->nr_slots; i++) {
+        if (__atomic_load_n(&fc->slots[i].owned, __ATOMIC_RELAXED) ||
+            __atomic_exchange_n(&fc->slots[i].owned, 1, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        /* the combiner scans up to the high water mark, raise it */
+        used = __atomic_load_n(&fc->used_slots, __ATOMIC_RELAXED);
+        while ((used <= i) &&
+               !__atomic_compare_exchange_n(&fc->used_slots, &used, i + 1, 0,
+                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        }
+        return &fc->slots[i];
+    }
+    return NULL;
+}
+
+void rule_tpl_fc_slot_put(struct rule_tpl_fc *fc, struct rule_tpl_fc_slot *slot)
+{
+    if ((NULL == fc) || (NULL == slot)) {
+        return;
+    }
+
+    /* no request is pending, the owner only returns when served */
+    __atomic_store_n(&slot->owned, 0, __ATOMIC_RELEASE);
+}
+
+static int rb_fc_slot_cmp(const void *a, const void *b)
+{
+    const struct rule_tpl_fc_slot *sa = *(struct rule_tpl_fc_slot * const *)a;
+    const struct rule_tpl_fc_slot *sb = *(struct rule_tpl_fc_slot * const *)b;
+
+    /* same order as the tree, bigger id on the left */
+    if (sa->id > sb->id) {
+        return -1;
+    }
+    else if (sa->id < sb->id) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+  serve one request, searching from finger, the node of the previous
+  one. return the node to search the next request from.
+ */
+static struct rule_tpl *rb_fc_apply(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot, struct rule_tpl *finger)
+{
+    struct rule_tpl *tpl;
+    struct rb_node *next;
+
+    switch (slot->op) {
+    case RB_FC_CREATE:
+        tpl = (struct rule_tpl *)malloc(fc->size);
+        if (NULL == tpl) {
+            break;
+        }
+        memset(tpl, 0, fc->size);
+        tpl->id = slot->id;
+        if (rule_tpl_finger_insert(&fc->root, finger, tpl) != 0) {
+            free(tpl);
+            break;
+        }
+        slot->result = tpl;
+        return tpl;
+    case RB_FC_DELETE:
+        tpl = (struct rule_tpl *)rule_tpl_finger_search(&fc->root, finger,
+                                                        slot->id);
+        if (NULL == tpl) {
+            break;
+        }
+        /* the next requests have smaller ids, they come after tpl */
+        next = rb_next(&tpl->node);
+        if (NULL == next) {
+            next = rb_prev(&tpl->node);
+        }
+        rb_erase(&tpl->node, &fc->root);
+        if (fc->tpl_free) {
+            fc->tpl_free(&tpl->node);
+        }
+        free((void *)tpl);
+        slot->ret = 0;
+        return next ? container_of(next, struct rule_tpl, node) : NULL;
+    case RB_FC_SEARCH:
+        tpl = (struct rule_tpl *)rule_tpl_finger_search(&fc->root, finger,
+                                                        slot->id);
+        if (NULL == tpl) {
+            break;
+        }
+        slot->result = tpl;
+        return tpl;
+    default:
+        break;
+    }
+    return finger;
+}
+
+/* called with the combiner role held */
+static void rb_fc_combine(struct rule_tpl_fc *fc)
+{
+    struct rule_tpl *finger = NULL;
+    int used;
+    int n = 0;
+    int i;
+
+    used = __atomic_load_n(&fc->used_slots, __ATOMIC_ACQUIRE);
+    if (used > fc->nr_slots) {
+        used = fc->nr_slots;
+    }
+
+    for (i = 0; i < used; i++) {
+        if (__atomic_load_n(&fc->slots[i].pending, __ATOMIC_ACQUIRE)) {
+            fc->batch[n++] = &fc->slots[i];
+        }
+    }
+    if (0 == n) {
+        return;
+    }
+
+    /* sorted requests walk the tree left to right in one pass */
+    if (n > 1) {
+        qsort(fc->batch, n, sizeof(fc->batch[0]), rb_fc_slot_cmp);
+    }
+    for (i = 0; i < n; i++) {
+        finger = rb_fc_apply(fc, fc->batch[i], finger);
+        __atomic_store_n(&fc->batch[i]->pending, 0, __ATOMIC_RELEASE);
+    }
+
+    fc->combines++;
+    fc->requests += n;
+}
+
+static void rb_fc_request(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot, int op, unsigned int id)
+{
+    slot->op = op;
+    slot->id = id;
+    slot->ret = -1;
+    slot->result = NULL;
+    __atomic_store_n(&slot->pending, 1, __ATOMIC_RELEASE);
+
+    for (;;) {
+        if (!__atomic_load_n(&fc->lock, __ATOMIC_RELAXED) &&
+            !__atomic_exchange_n(&fc->lock, 1, __ATOMIC_ACQUIRE)) {
+            rb_fc_combine(fc);
+            __atomic_store_n(&fc->lock, 0, __ATOMIC_RELEASE);
+        }
+        if (!__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        rb_fc_relax();
+    }
+}
+
+void *rule_tpl_fc_create(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot, unsigned int id)
+{
+    if ((NULL == fc) || (NULL == slot)) {
+        return NULL;
+    }
+
+    rb_fc_request(fc, slot, RB_FC_CREATE, id);
+    return slot->result;
+}
+
+int rule_tpl_fc_delete(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot, unsigned int id)
+{
+    if ((NULL == fc) || (NULL == slot)) {
+        return -1;
+    }
+
+    rb_fc_request(fc, slot, RB_FC_DELETE, id);
+    return slot->ret;
+}
+
+void *rule_tpl_fc_search(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot, unsigned int id)
+{
+    if ((NULL == fc) || (NULL == slot)) {
+        return NULL;
+    }
+
+    rb_fc_request(fc, slot, RB_FC_SEARCH, id);
+    return slot->result;
+}
@@ -0,0 +1,78 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_FC_H
+#define	___RB_FC_H
+
+#include "rbtree.h"
+
+/*
+  flat combining rule table
+  Every thread publishes its request in its own slot. The thread that
+  gets the combiner role collects all the published requests, sorts
+  them by id and applies them to the tree in one pass: every request
+  is served by a finger search from the node of the previous one, so
+  the tree stays in the cache of one core instead of bouncing between
+  cores.
+  A node returned by create or search is not protected: a delete of
+  another thread, in a later batch, may free it.
+ */
+#define RB_FC_CREATE    1
+#define RB_FC_DELETE    2
+#define RB_FC_SEARCH    3
+
+struct rule_tpl_fc_slot {
+    int                 owned;      /* slot held by a thread */
+    int                 pending;    /* request published, not served */
+    int                 op;         /* RB_FC_CREATE/DELETE/SEARCH */
+    unsigned int        id;
+    int                 ret;        /* delete result */
+    void               *result;     /* create/search result */
+} __attribute__((aligned(64)));
+
+struct rule_tpl_fc {
+    struct rb_root            root;
+    unsigned long             size;     /* size of actual table */
+    TPL_FREE                  tpl_free;
+    int                       lock;     /* combiner role */
+    int                       nr_slots;
+    int                       used_slots;   /* high water mark */
+    struct rule_tpl_fc_slot  *slots;
+    struct rule_tpl_fc_slot **batch;    /* combiner scratch */
+    unsigned long             combines; /* batches applied */
+    unsigned long             requests; /* requests applied */
+};
+
+/*
+  flat combining table create function
+  size       : the size of actual table, must be more than sizeof(struct rule_tpl)
+  max_threads: the max number of threads to get a slot
+  tpl_free   : the free function called on delete, may be NULL
+ */
+extern struct rule_tpl_fc *rule_tpl_fc_alloc(unsigned long size,
+            int max_threads, TPL_FREE tpl_free);
+extern void rule_tpl_fc_free(struct rule_tpl_fc *fc);
+
+/*
+  get a free slot for the calling thread, once per thread.
+  return NULL if max_threads slots are held.
+ */
+extern struct rule_tpl_fc_slot *rule_tpl_fc_slot_get(struct rule_tpl_fc *fc);
+/* give the slot back when the thread is done with the table */
+extern void rule_tpl_fc_slot_put(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot);
+
+/* same semantics as rule_tpl_create/rule_tpl_delete/rule_tpl_search */
+extern void *rule_tpl_fc_create(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot, unsigned int id);
+extern int rule_tpl_fc_delete(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot, unsigned int id);
+extern void *rule_tpl_fc_search(struct rule_tpl_fc *fc,
+            struct rule_tpl_fc_slot *slot, unsigned int id);
+
+#endif	/* ___RB_FC_H */
@@ -0,0 +1,181 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Rule tables indexed by an open addressing hash besides the tree.
+ */
+#include "rb_hash.h"
+
+#define RB_HASH_MIN_SLOTS   16
+
+/* slots for n ids, at most 3/4 full */
+static unsigned long rb_hash_slots(unsigned long n, unsigned int *shift)
+{
+    unsigned long slots = RB_HASH_MIN_SLOTS;
+    unsigned int bits = 4;
+
+    while (slots * 3 / 4 < n) {
+        slots <<= 1;
+        bits++;
+    }
+    *shift = 64 - bits;
+    return slots;
+}
+
+static void rb_hash_link(struct rule_tpl_htable *ht, struct rule_tpl *tpl)
+{
+    unsigned long i = rule_tpl_hslot_index(ht, tpl->id);
+
+    while (ht->slots[i].tpl) {
+        i = (i + 1) & ht->mask;
+    }
+    ht->slots[i].id = tpl->id;
+    ht->slots[i].tpl = tpl;
+}
+
+static int rb_hash_grow(struct rule_tpl_htable *ht)
+{
+    struct rule_tpl_hslot *old = ht->slots;
+    unsigned long old_slots = ht->mask + 1;
+    unsigned long slots;
+    unsigned long i;
+    unsigned int shift;
+
+    slots = rb_hash_slots(ht->count + 1, &shift);
+    if (slots <= old_slots) {
+        return 0;
+    }
+
+    ht->slots = (struct rule_tpl_hslot *)calloc(slots, sizeof(*ht->slots));
+    if (NULL == ht->slots) {
+        ht->slots = old;
+        return -1;
+    }
+    ht->mask = slots - 1;
+    ht->shift = shift;
+
+    for (i = 0; i < old_slots; i++) {
+        if (old[i].tpl) {
+            rb_hash_link(ht, old[i].tpl);
+        }
+    }
+    free(old);
+    return 0;
+}
+
+struct rule_tpl_htable *rule_tpl_htable_alloc(unsigned long size,
+            unsigned long capacity)
+{
+    struct rule_tpl_htable *ht;
+    unsigned long slots;
+    unsigned int shift;
+
+    if (size < sizeof(struct rule_tpl)) {
+        return NULL;
+    }
+
+    ht = (struct rule_tpl_htable *)malloc(sizeof(*ht));
+    if (NULL == ht) {
+        return NULL;
+    }
+    memset(ht, 0, sizeof(*ht));
+
+    slots = rb_hash_slots(capacity, &shift);
+    ht->slots = (struct rule_tpl_hslot *)calloc(slots, sizeof(*ht->slots));
+    if (NULL == ht->slots) {
+        free(ht);
+        return NULL;
+    }
+    ht->root = RB_ROOT;
+    ht->size = size;
+    ht->mask = slots - 1;
+    ht->shift = shift;
+    return ht;
+}
+
+void rule_tpl_htable_free(struct rule_tpl_htable *ht, TPL_FREE tpl_free)
+{
+    if (NULL == ht) {
+        return;
+    }
+
+    rule_tpl_tree_clear(&ht->root, tpl_free);
+    free(ht->slots);
+    free(ht);
+}
+
+void *rule_tpl_htable_create(struct rule_tpl_htable *ht, unsigned int id)
+{
+    struct rule_tpl *tpl;
+
+    if (NULL == ht) {
+        return NULL;
+    }
+    if (rule_tpl_htable_search(ht, id)) {
+        return NULL;
+    }
+
+    /* grow first, a failure leaves both indexes untouched */
+    if (rb_hash_grow(ht) != 0) {
+        return NULL;
+    }
+
+    tpl = (struct rule_tpl *)rule_tpl_create(&ht->root, id, ht->size);
+    if (NULL == tpl) {
+        return NULL;
+    }
+    rb_hash_link(ht, tpl);
+    ht->count++;
+    return (void *)tpl;
+}
+
+int rule_tpl_htable_delete(struct rule_tpl_htable *ht, unsigned int id,
+            TPL_FREE tpl_free)
+{
+    struct rule_tpl *tpl;
+    unsigned long i, j, home;
+
+    if (NULL == ht) {
+        return -1;
+    }
+
+    i = rule_tpl_hslot_index(ht, id);
+    for (;;) {
+        if (NULL == ht->slots[i].tpl) {
+            return -1;
+        }
+        if (ht->slots[i].id == id) {
+            break;
+        }
+        i = (i + 1) & ht->mask;
+    }
+    tpl = ht->slots[i].tpl;
+
+    /* shift back the slots whose home is not in (i, j] */
+    j = i;
+    for (;;) {
+        j = (j + 1) & ht->mask;
+        if (NULL == ht->slots[j].tpl) {
+            break;
+        }
+        home = rule_tpl_hslot_index(ht, ht->slots[j].id);
+        if (((j - home) & ht->mask) >= ((j - i) & ht->mask)) {
+            ht->slots[i] = ht->slots[j];
+            i = j;
+        }
+    }
+    ht->slots[i].tpl = NULL;
+    ht->slots[i].id = 0;
+    ht->count--;
+
+    rb_erase(&tpl->node, &ht->root);
+    if (tpl_free) {
+        tpl_free(&tpl->node);
+    }
+    free((void *)tpl);
+    return 0;
+}
@@ -0,0 +1,91 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_HASH_H
+#define	___RB_HASH_H
+
+#include <stdint.h>
+#include "rbtree.h"
+
+/*
+  hash indexed rule table
+  Every node is linked in the rbtree and in an open addressing hash
+  index, kept in sync by create and delete. Exact id lookups probe the
+  index in O(1), the slots keep the id so a miss never touches a node.
+  The tree is still the table: rb_first/rb_next walks on root work as
+  on a plain rule table, and so do the other rule_tpl functions that
+  only read it.
+  Linear probing, deletion shifts the following slots back, so there
+  are no tombstones. The table is not thread safe.
+ */
+struct rule_tpl_hslot {
+    unsigned int         id;
+    struct rule_tpl     *tpl;       /* NULL for a free slot */
+};
+
+struct rule_tpl_htable {
+    struct rb_root           root;
+    unsigned long            size;      /* size of actual table */
+    unsigned long            count;
+    unsigned long            mask;      /* slots - 1, slots is power of 2 */
+    unsigned int             shift;     /* 64 - log2(slots) */
+    struct rule_tpl_hslot   *slots;
+};
+
+/*
+  hash table create function
+  size    : the size of actual table, must be more than sizeof(struct rule_tpl)
+  capacity: the expected number of ids, the index grows beyond it
+ */
+extern struct rule_tpl_htable *rule_tpl_htable_alloc(unsigned long size,
+            unsigned long capacity);
+extern void rule_tpl_htable_free(struct rule_tpl_htable *ht,
+            TPL_FREE tpl_free);
+
+/* same semantics as rule_tpl_create/rule_tpl_delete */
+extern void *rule_tpl_htable_create(struct rule_tpl_htable *ht,
+            unsigned int id);
+extern int rule_tpl_htable_delete(struct rule_tpl_htable *ht,
+            unsigned int id, TPL_FREE tpl_free);
+
+/* fibonacci hashing, the top bits of the product pick the slot */
+static inline unsigned long
+rule_tpl_hslot_index(const struct rule_tpl_htable *ht, unsigned int id)
+{
+    return (unsigned long)(((uint64_t)id * 0x9e3779b97f4a7c15ULL) >> ht->shift);
+}
+
+/*
+  rule templet search function
+  ht: the hash indexed table
+  id: the id of actual table
+ */
+static inline void *
+rule_tpl_htable_search(const struct rule_tpl_htable *ht, unsigned int id)
+{
+    const struct rule_tpl_hslot *slot;
+    unsigned long i;
+
+    if (NULL == ht) {
+        return NULL;
+    }
+
+    i = rule_tpl_hslot_index(ht, id);
+    for (;;) {
+        slot = &ht->slots[i];
+        if (NULL == slot->tpl) {
+            return NULL;
+        }
+        if (slot->id == id) {
+            return (void *)slot->tpl;
+        }
+        i = (i + 1) & ht->mask;
+    }
+}
+
+#endif	/* ___RB_HASH_H */
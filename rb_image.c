@@ -0,0 +1,490 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Memory mapped rule table image for warm restart.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "rb_image.h"
+
+#define RB_IMAGE_HDR_SIZE   128
+
+/* the header is padded to RB_IMAGE_HDR_SIZE in the file */
+typedef char rb_image_hdr_fits[(sizeof(struct rb_image_hdr) <=
+                                RB_IMAGE_HDR_SIZE) ? 1 : -1];
+
+static unsigned int rb_image_crc(const char *buf, unsigned long len)
+{
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+    unsigned int piece;
+
+    /* crc32() takes an unsigned int length */
+    while (len) {
+        piece = (len > (1UL << 30)) ? (1U << 30) : (unsigned int)len;
+        crc = crc32(crc, (const Bytef *)buf, piece);
+        buf += piece;
+        len -= piece;
+    }
+    return (unsigned int)crc;
+}
+
+static unsigned int rb_image_hdr_crc(const struct rb_image_hdr *hdr)
+{
+    struct rb_image_hdr tmp = *hdr;
+
+    tmp.hdr_crc = 0;
+    return rb_image_crc((const char *)&tmp, sizeof(tmp));
+}
+
+int rule_tpl_image_save(struct rb_root *root, unsigned long size,
+            const char *path)
+{
+    struct rb_image_hdr hdr;
+    struct rb_node **queue = NULL;
+    unsigned long *parent = NULL;
+    struct rb_node *node;
+    char *buf = NULL;
+    char tmp_path[4096];
+    unsigned long count = 0;
+    unsigned long tail;
+    unsigned long i;
+    int ret = -1;
+    FILE *fp = NULL;
+
+    if ((NULL == root) || (NULL == path) || (size < sizeof(struct rule_tpl))) {
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RB_IMAGE_MAGIC, sizeof(RB_IMAGE_MAGIC));
+    hdr.version = RB_IMAGE_VERSION;
+    hdr.endian = RB_IMAGE_ENDIAN;
+    hdr.hdr_size = RB_IMAGE_HDR_SIZE;
+    hdr.node_size = (size + sizeof(long) - 1) & ~(sizeof(long) - 1);
+    hdr.body_off = RB_IMAGE_HDR_SIZE;
+
+    for (node = rb_first(root); node != NULL; node = rb_next(node)) {
+        count++;
+    }
+    hdr.count = count;
+    hdr.body_len = count * hdr.node_size;
+    hdr.root = count ? hdr.body_off : 0;
+
+    /* a truncated name would be renamed over something else */
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+        (int)sizeof(tmp_path)) {
+        return -1;
+    }
+    if (count) {
+        queue = (struct rb_node **)malloc(count * sizeof(*queue));
+        parent = (unsigned long *)malloc(count * sizeof(*parent));
+        buf = (char *)malloc(hdr.body_len);
+        if ((NULL == queue) || (NULL == parent) || (NULL == buf)) {
+            goto out;
+        }
+        memset(buf, 0, hdr.body_len);
+    }
+
+    /* breadth first, the offset of a node is known when it is queued */
+    tail = 0;
+    if (count) {
+        queue[tail] = root->rb_node;
+        parent[tail++] = 0;
+    }
+    for (i = 0; i < tail; i++) {
+        struct rb_node *img;
+        unsigned long off = hdr.body_off + i * hdr.node_size;
+
+        node = queue[i];
+        img = (struct rb_node *)(buf + i * hdr.node_size);
+        memcpy(img, node, size);
+
+        img->rb_parent_color = parent[i] | rb_color(node);
+        img->rb_left = NULL;
+        img->rb_right = NULL;
+        if (node->rb_left) {
+            img->rb_left = (struct rb_node *)
+                (hdr.body_off + tail * hdr.node_size);
+            queue[tail] = node->rb_left;
+            parent[tail++] = off;
+        }
+        if (node->rb_right) {
+            img->rb_right = (struct rb_node *)
+                (hdr.body_off + tail * hdr.node_size);
+            queue[tail] = node->rb_right;
+            parent[tail++] = off;
+        }
+    }
+
+    hdr.body_crc = rb_image_crc(buf, hdr.body_len);
+    hdr.hdr_crc = rb_image_hdr_crc(&hdr);
+
+    fp = fopen(tmp_path, "wb");
+    if (NULL == fp) {
+        goto out;
+    }
+    {
+        char pad[RB_IMAGE_HDR_SIZE];
+        memset(pad, 0, sizeof(pad));
+        memcpy(pad, &hdr, sizeof(hdr));
+        if (fwrite(pad, sizeof(pad), 1, fp) != 1) {
+            goto out;
+        }
+    }
+    if (count && (fwrite(buf, hdr.body_len, 1, fp) != 1)) {
+        goto out;
+    }
+    if ((fflush(fp) != 0) || (fsync(fileno(fp)) != 0)) {
+        goto out;
+    }
+    fclose(fp);
+    fp = NULL;
+
+    if (rename(tmp_path, path) != 0) {
+        goto out;
+    }
+    ret = 0;
+
+out:
+    if (fp) {
+        fclose(fp);
+    }
+    if (ret != 0) {
+        unlink(tmp_path);
+    }
+    free(buf);
+    free(parent);
+    free(queue);
+    return ret;
+}
+
+/* a link must be NULL or point at the start of a node in the body */
+static int rb_image_link_ok(const struct rb_image_hdr *hdr, unsigned long off)
+{
+    if (0 == off) {
+        return 1;
+    }
+    if ((off < hdr->body_off) || (off >= hdr->body_off + hdr->body_len)) {
+        return 0;
+    }
+    return ((off - hdr->body_off) % hdr->node_size) == 0;
+}
+
+static int rb_image_check(const char *base, unsigned long len)
+{
+    const struct rb_image_hdr *hdr = (const struct rb_image_hdr *)base;
+    unsigned long i;
+
+    if (len < RB_IMAGE_HDR_SIZE) {
+        return -1;
+    }
+    if (memcmp(hdr->magic, RB_IMAGE_MAGIC, sizeof(RB_IMAGE_MAGIC)) != 0) {
+        return -1;
+    }
+    if ((hdr->version != RB_IMAGE_VERSION) ||
+        (hdr->endian != RB_IMAGE_ENDIAN) ||
+        (hdr->hdr_crc != rb_image_hdr_crc(hdr))) {
+        return -1;
+    }
+    if ((hdr->hdr_size != RB_IMAGE_HDR_SIZE) ||
+        (hdr->body_off != RB_IMAGE_HDR_SIZE) ||
+        (hdr->node_size < sizeof(struct rule_tpl)) ||
+        (hdr->body_len != hdr->count * hdr->node_size) ||
+        (hdr->body_off + hdr->body_len != len)) {
+        return -1;
+    }
+    if (hdr->body_crc != rb_image_crc(base + hdr->body_off, hdr->body_len)) {
+        return -1;
+    }
+
+    /* the lookups trust the links, check them once here */
+    if (!rb_image_link_ok(hdr, hdr->root) || (!hdr->root != !hdr->count)) {
+        return -1;
+    }
+    for (i = 0; i < hdr->count; i++) {
+        const struct rb_node *node = (const struct rb_node *)
+            (base + hdr->body_off + i * hdr->node_size);
+        if (!rb_image_link_ok(hdr, node->rb_parent_color & ~3UL) ||
+            !rb_image_link_ok(hdr, (unsigned long)node->rb_left) ||
+            !rb_image_link_ok(hdr, (unsigned long)node->rb_right)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static struct rb_node *rb_image_ptr(const struct rule_tpl_image *img,
+            unsigned long off)
+{
+    return off ? (struct rb_node *)(img->base + off) : NULL;
+}
+
+static struct rb_node *rb_image_parent(const struct rule_tpl_image *img,
+            const struct rb_node *node)
+{
+    unsigned long pc = node->rb_parent_color & ~3UL;
+
+    if (rb_image_frozen(img, node)) {
+        return rb_image_ptr(img, pc);
+    }
+    return (struct rb_node *)pc;
+}
+
+/* turn the offsets of one node into pointers of the private mapping */
+static void rb_image_thaw(struct rule_tpl_image *img, struct rb_node *node)
+{
+    unsigned long pc = node->rb_parent_color;
+    unsigned long i;
+
+    if (!rb_image_frozen(img, node)) {
+        return;
+    }
+    node->rb_parent_color = (unsigned long)rb_image_ptr(img, pc & ~3UL) |
+                            (pc & 3UL);
+    node->rb_left = rb_image_ptr(img, (unsigned long)node->rb_left);
+    node->rb_right = rb_image_ptr(img, (unsigned long)node->rb_right);
+
+    i = ((char *)node - img->base - img->hdr->body_off) / img->hdr->node_size;
+    img->thawed[i / RB_IMAGE_LONG_BITS] |= 1UL << (i % RB_IMAGE_LONG_BITS);
+}
+
+/*
+  thaw node and its descendants down to depth levels below it.
+  rb_insert_color() reads and relinks the children of the nodes on the
+  path, __rb_erase_color() goes down to the grand children of the
+  sibling (the double rotation), so depth 1 covers an insert and depth
+  4 an erase; colors of deeper nodes are read and set in either form.
+ */
+static void rb_image_thaw_near(struct rule_tpl_image *img,
+            struct rb_node *node, int depth)
+{
+    rb_image_thaw(img, node);
+    if (depth > 0) {
+        if (node->rb_left) {
+            rb_image_thaw_near(img, node->rb_left, depth - 1);
+        }
+        if (node->rb_right) {
+            rb_image_thaw_near(img, node->rb_right, depth - 1);
+        }
+    }
+}
+
+/* thaw the search path of id with the given depth, return the last node */
+static struct rb_node *rb_image_thaw_path(struct rule_tpl_image *img,
+            unsigned int id, int depth)
+{
+    struct rb_node *node = img->root.rb_node;
+    struct rb_node *last = NULL;
+
+    while (node) {
+        struct rule_tpl *cur = container_of(node, struct rule_tpl, node);
+
+        rb_image_thaw_near(img, node, depth);
+        last = node;
+        if (cur->id < id) {
+            node = node->rb_left;
+        }
+        else if (cur->id > id) {
+            node = node->rb_right;
+        }
+        else {
+            break;
+        }
+    }
+    return last;
+}
+
+struct rule_tpl_image *rule_tpl_image_open(const char *path, int flags)
+{
+    struct rule_tpl_image *img;
+    struct rb_image_hdr *hdr;
+    struct stat st;
+    void *base;
+    int fd;
+
+    if (NULL == path) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if ((fstat(fd, &st) != 0) || (st.st_size < RB_IMAGE_HDR_SIZE)) {
+        close(fd);
+        return NULL;
+    }
+
+    if (flags & RB_IMAGE_COW) {
+        base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+    }
+    else {
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (rb_image_check((const char *)base, st.st_size) != 0) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    img = (struct rule_tpl_image *)malloc(sizeof(*img));
+    if (NULL == img) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    memset(img, 0, sizeof(*img));
+    hdr = (struct rb_image_hdr *)base;
+    img->base = (char *)base;
+    img->len = st.st_size;
+    img->flags = flags;
+    img->hdr = hdr;
+    img->root.rb_node = rb_image_ptr(img, hdr->root);
+
+    if (flags & RB_IMAGE_COW) {
+        /* at least one word, so thawed is never NULL in this mode */
+        img->thawed = (unsigned long *)calloc(
+            hdr->count / RB_IMAGE_LONG_BITS + 1, sizeof(unsigned long));
+        if (NULL == img->thawed) {
+            munmap(base, st.st_size);
+            free(img);
+            return NULL;
+        }
+    }
+    return img;
+}
+
+static int rb_image_owns(const struct rule_tpl_image *img,
+            const struct rb_node *node)
+{
+    return ((const char *)node >= img->base) &&
+           ((const char *)node < img->base + img->len);
+}
+
+/* image payloads come from another process, not to be freed */
+static void rb_image_node_free(struct rule_tpl_image *img,
+            struct rb_node *node, TPL_FREE tpl_free)
+{
+    if (!rb_image_owns(img, node)) {
+        if (tpl_free) {
+            tpl_free(node);
+        }
+        free((void *)node);
+    }
+}
+
+void rule_tpl_image_close(struct rule_tpl_image *img, TPL_FREE tpl_free)
+{
+    struct rb_node *node, *next, *parent;
+
+    if (NULL == img) {
+        return;
+    }
+
+    /*
+      post order walk up the parent links, it writes nothing, so the
+      pages of the image still shared are not copied on the way out
+     */
+    node = (img->flags & RB_IMAGE_COW) ? img->root.rb_node : NULL;
+    while (node) {
+        for (;;) {
+            next = rb_image_link(img, node, node->rb_left);
+            if (NULL == next) {
+                next = rb_image_link(img, node, node->rb_right);
+            }
+            if (NULL == next) {
+                break;
+            }
+            node = next;
+        }
+        for (;;) {
+            parent = rb_image_parent(img, node);
+            next = NULL;
+            if (parent) {
+                next = rb_image_link(img, parent, parent->rb_right);
+                if (next == node) {
+                    next = NULL;
+                }
+            }
+            rb_image_node_free(img, node, tpl_free);
+            node = next ? next : parent;
+            if ((NULL == node) || next) {
+                break;
+            }
+        }
+    }
+    munmap(img->base, img->len);
+    free(img->thawed);
+    free(img);
+}
+
+void *rule_tpl_image_create(struct rule_tpl_image *img, unsigned int id,
+            unsigned long size)
+{
+    struct rule_tpl *tpl;
+    struct rb_node *parent;
+
+    if ((NULL == img) || !(img->flags & RB_IMAGE_COW)) {
+        return NULL;
+    }
+    /* fail before anything is thawed */
+    if (rule_tpl_image_search(img, id)) {
+        return NULL;
+    }
+    tpl = (struct rule_tpl *)malloc(size);
+    if (NULL == tpl) {
+        return NULL;
+    }
+    memset(tpl, 0, size);
+    tpl->id = id;
+
+    parent = rb_image_thaw_path(img, id, 1);
+    if (NULL == parent) {
+        rb_link_node(&tpl->node, NULL, &img->root.rb_node);
+    }
+    else if (((struct rule_tpl *)parent)->id < id) {
+        rb_link_node(&tpl->node, parent, &parent->rb_left);
+    }
+    else {
+        rb_link_node(&tpl->node, parent, &parent->rb_right);
+    }
+    rb_insert_color(&tpl->node, &img->root);
+    return (void *)tpl;
+}
+
+int rule_tpl_image_delete(struct rule_tpl_image *img, unsigned int id,
+            TPL_FREE tpl_free)
+{
+    struct rb_node *node, *next;
+
+    if ((NULL == img) || !(img->flags & RB_IMAGE_COW)) {
+        return -1;
+    }
+    if (NULL == rule_tpl_image_search(img, id)) {
+        return -1;
+    }
+
+    node = rb_image_thaw_path(img, id, 4);
+    /* rb_erase() moves the successor up, its path is rebalanced too */
+    if (node->rb_left && node->rb_right) {
+        for (next = node->rb_right; next != NULL; next = next->rb_left) {
+            rb_image_thaw_near(img, next, 4);
+        }
+    }
+
+    rb_erase(node, &img->root);
+    rb_image_node_free(img, node, tpl_free);
+    return 0;
+}
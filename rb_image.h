@@ -0,0 +1,152 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_IMAGE_H
+#define	___RB_IMAGE_H
+
+#include "rbtree.h"
+
+/*
+  rule table image file
+  The nodes are stored in breadth first order of the tree with the
+  whole actual table as payload. rb_parent_color, rb_left and rb_right
+  hold offsets from the start of the file instead of pointers, 0 is
+  NULL, so the file is searched straight from mmap.
+  The payload is saved as is: pointers in it belong to the process that
+  saved the image, so image payloads must not own resources.
+ */
+#define RB_IMAGE_MAGIC      "RBIMAGE"
+#define RB_IMAGE_VERSION    1
+#define RB_IMAGE_ENDIAN     0x01020304
+
+/* open flags */
+#define RB_IMAGE_RDONLY     0   /* shared read only mapping */
+#define RB_IMAGE_COW        1   /* private mapping, updates allowed */
+
+#define RB_IMAGE_LONG_BITS  (8 * sizeof(unsigned long))
+
+struct rb_image_hdr {
+    char            magic[8];
+    unsigned int    version;
+    unsigned int    endian;
+    unsigned long   hdr_size;
+    unsigned long   node_size;  /* size of actual table */
+    unsigned long   count;      /* nodes */
+    unsigned long   root;       /* offset of the root node */
+    unsigned long   body_off;   /* offset of the first node */
+    unsigned long   body_len;
+    unsigned int    body_crc;   /* crc32 of the nodes */
+    unsigned int    hdr_crc;    /* crc32 of the header, this field 0 */
+};
+
+struct rule_tpl_image {
+    char                *base;
+    unsigned long        len;
+    int                  flags;
+    struct rb_image_hdr *hdr;
+    struct rb_root       root;
+    unsigned long       *thawed;    /* RB_IMAGE_COW: nodes holding pointers */
+};
+
+/*
+  rule templet image save function
+  root: the rb_root of actual table
+  size: the size of actual table, must be more than sizeof(struct rule_tpl)
+  path: the image file, replaced atomically
+ */
+extern int rule_tpl_image_save(struct rb_root *root, unsigned long size,
+            const char *path);
+
+/*
+  rule templet image open function, checks version and checksums.
+  In RB_IMAGE_COW mode the image nodes keep their offsets, so opening
+  writes nothing to the mapping. An update turns to pointers ("thaws")
+  only the nodes its rebalance may read or relink, so only their pages
+  are copied. The tree mixes both forms: it must only be used through
+  the rule_tpl_image functions, never with rb_first() or rule_tpl_*().
+  tpl_free of close and delete is called only on the nodes created
+  after open, never on the nodes of the image.
+ */
+extern struct rule_tpl_image *rule_tpl_image_open(const char *path,
+            int flags);
+extern void rule_tpl_image_close(struct rule_tpl_image *img,
+            TPL_FREE tpl_free);
+
+/*
+  rule templet image create function, RB_IMAGE_COW only
+  img : the opened image
+  id  : the id of actual table
+  size: the size of actual table, must be more than sizeof(struct rule_tpl)
+  return the zeroed node, NULL if the id exists or out of memory
+ */
+extern void *rule_tpl_image_create(struct rule_tpl_image *img,
+            unsigned int id, unsigned long size);
+extern int rule_tpl_image_delete(struct rule_tpl_image *img,
+            unsigned int id, TPL_FREE tpl_free);
+
+/* an image node still holding offsets */
+static inline int
+rb_image_frozen(const struct rule_tpl_image *img, const struct rb_node *node)
+{
+    unsigned long i;
+
+    if (((const char *)node < img->base) ||
+        ((const char *)node >= img->base + img->len)) {
+        return 0;
+    }
+    if (NULL == img->thawed) {
+        return 1;
+    }
+    i = ((const char *)node - img->base - img->hdr->body_off) /
+        img->hdr->node_size;
+    return !((img->thawed[i / RB_IMAGE_LONG_BITS] >> (i % RB_IMAGE_LONG_BITS))
+             & 1UL);
+}
+
+/* follow rb_left or rb_right of node, whatever form node is in */
+static inline struct rb_node *
+rb_image_link(const struct rule_tpl_image *img, const struct rb_node *node,
+              struct rb_node *link)
+{
+    if (link && rb_image_frozen(img, node)) {
+        return (struct rb_node *)(img->base + (unsigned long)link);
+    }
+    return link;
+}
+
+/*
+  rule templet image search function
+  img: the opened image
+  id : the id of actual table
+ */
+static inline void *
+rule_tpl_image_search(struct rule_tpl_image *img, unsigned int id)
+{
+    struct rb_node *node;
+
+    if (NULL == img) {
+        return NULL;
+    }
+
+    node = img->root.rb_node;
+    while (node) {
+        struct rule_tpl *cur = container_of(node, struct rule_tpl, node);
+        if (cur->id < id) {
+            node = rb_image_link(img, node, node->rb_left);
+        }
+        else if (cur->id > id) {
+            node = rb_image_link(img, node, node->rb_right);
+        }
+        else {
+            return (void *)cur;
+        }
+    }
+    return NULL;
+}
+
+#endif	/* ___RB_IMAGE_H */
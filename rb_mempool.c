@@ -0,0 +1,365 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Node pool backed by huge pages and bound to a NUMA node.
+ * mbind/getcpu are called through syscall(), so libnuma is not needed.
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "rb_mempool.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB    (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB    (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define RB_MPOL_BIND    2
+#define RB_NUMA_MAX     1024
+
+static const unsigned long page_sizes[] = {
+    [RB_PAGE_4K] = 4096UL,
+    [RB_PAGE_2M] = 2UL << 20,
+    [RB_PAGE_1G] = 1UL << 30,
+};
+
+static int rb_numa_bind(void *addr, unsigned long len, int node)
+{
+    unsigned long mask[RB_NUMA_MAX / (8 * sizeof(unsigned long))];
+
+    if ((node < 0) || (node >= RB_NUMA_MAX)) {
+        return -1;
+    }
+
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |=
+        1UL << (node % (8 * sizeof(unsigned long)));
+    return (int)syscall(SYS_mbind, addr, len, RB_MPOL_BIND,
+                        mask, (unsigned long)RB_NUMA_MAX, 0);
+}
+
+/*
+  Free huge pages of a size on a node, -1 if unknown.
+  The hugetlb reservation made by mmap is counted on the global pool,
+  so a mapping later bound to a node without free huge pages gets
+  SIGBUS on the first touch instead of failing.
+ */
+static long rb_numa_free_huge(int node, int page)
+{
+    char path[128];
+    FILE *fp;
+    long nr = -1;
+
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/node/node%d/hugepages/hugepages-%lukB/free_hugepages",
+             node, page_sizes[page] >> 10);
+    fp = fopen(path, "r");
+    if (NULL == fp) {
+        return -1;
+    }
+    if (fscanf(fp, "%ld", &nr) != 1) {
+        nr = -1;
+    }
+    fclose(fp);
+    return nr;
+}
+
+/* huge pages of a size may back len bytes bound to node */
+static int rb_huge_fits(unsigned long len, int page, int node)
+{
+    if (RB_NUMA_ANY == node) {
+        return 1;
+    }
+    return rb_numa_free_huge(node, page) >= (long)(len / page_sizes[page]);
+}
+
+/*
+  Map len bytes aligned to the page size, trying the requested page type
+  first and falling back to smaller pages. With a node, huge pages are
+  only used if the node has enough of them free.
+ */
+static void *rb_chunk_map(unsigned long len, int page, int node,
+            int *got, int *thp)
+{
+    void *addr;
+    unsigned long align;
+    char *raw;
+    unsigned long head;
+    int flags;
+
+    *thp = 0;
+    if ((page != RB_PAGE_4K) && rb_huge_fits(len, page, node)) {
+        flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                ((page == RB_PAGE_1G) ? MAP_HUGE_1GB : MAP_HUGE_2MB);
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (addr != MAP_FAILED) {
+            *got = page;
+            return addr;
+        }
+    }
+    /* no reserved huge pages, try 2M pages for a 1G request */
+    if ((page == RB_PAGE_1G) && rb_huge_fits(len, RB_PAGE_2M, node)) {
+        flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB;
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (addr != MAP_FAILED) {
+            *got = RB_PAGE_2M;
+            return addr;
+        }
+    }
+
+    /* normal pages, aligned to 2M so that THP can back them */
+    align = (page == RB_PAGE_4K) ? page_sizes[RB_PAGE_4K] :
+                                   page_sizes[RB_PAGE_2M];
+    raw = (char *)mmap(NULL, len + align, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((void *)raw == MAP_FAILED) {
+        return NULL;
+    }
+    head = (align - ((unsigned long)raw & (align - 1))) & (align - 1);
+    if (head) {
+        munmap(raw, head);
+    }
+    munmap(raw + head + len, align - head);
+    addr = raw + head;
+
+#ifdef MADV_HUGEPAGE
+    if ((page != RB_PAGE_4K) && (0 == madvise(addr, len, MADV_HUGEPAGE))) {
+        *thp = 1;
+    }
+#endif
+    *got = RB_PAGE_4K;
+    return addr;
+}
+
+static int rb_mempool_grow(struct rb_mempool *pool)
+{
+    struct rb_mempool_chunk *chunk;
+    unsigned long len;
+    unsigned long hdr;
+    int got;
+    int thp;
+
+    len = pool->chunk_size;
+    chunk = (struct rb_mempool_chunk *)rb_chunk_map(len, pool->page,
+                                                    pool->numa_node,
+                                                    &got, &thp);
+    if (NULL == chunk) {
+        return -1;
+    }
+
+    /* Bind before the first touch, the header write faults the page in */
+    if (pool->numa_node != RB_NUMA_ANY) {
+        if (rb_numa_bind(chunk, len, pool->numa_node) != 0) {
+            pool->numa_bound = 0;
+        }
+    }
+
+    chunk->next = pool->chunks;
+    chunk->len = len;
+    chunk->page = got;
+    chunk->thp = thp;
+    pool->chunks = chunk;
+
+    hdr = (sizeof(*chunk) + pool->obj_size - 1) / pool->obj_size;
+    pool->cur = (char *)chunk + hdr * pool->obj_size;
+    pool->end = (char *)chunk + (len / pool->obj_size) * pool->obj_size;
+    return 0;
+}
+
+struct rb_mempool *rb_mempool_create(unsigned long obj_size,
+            unsigned long nr_objs, int page, int numa_node)
+{
+    struct rb_mempool *pool;
+    unsigned long psize;
+    unsigned long len;
+
+    if ((obj_size < sizeof(struct rule_tpl)) || (0 == nr_objs) ||
+        (page < RB_PAGE_4K) || (page > RB_PAGE_1G)) {
+        return NULL;
+    }
+
+    pool = (struct rb_mempool *)malloc(sizeof(*pool));
+    if (NULL == pool) {
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    pool->obj_size = (obj_size + sizeof(long) - 1) & ~(sizeof(long) - 1);
+    pool->page = page;
+    pool->numa_node = numa_node;
+    pool->numa_bound = (numa_node != RB_NUMA_ANY);
+
+    /* one extra object for the chunk header */
+    psize = page_sizes[page];
+    len = (nr_objs + 1) * pool->obj_size;
+    pool->chunk_size = (len + psize - 1) & ~(psize - 1);
+
+    if (rb_mempool_grow(pool) != 0) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void rb_mempool_destroy(struct rb_mempool *pool)
+{
+    struct rb_mempool_chunk *chunk;
+
+    if (NULL == pool) {
+        return;
+    }
+
+    while ((chunk = pool->chunks) != NULL) {
+        pool->chunks = chunk->next;
+        munmap(chunk, chunk->len);
+    }
+    free(pool);
+}
+
+void *rb_mempool_alloc(struct rb_mempool *pool)
+{
+    void *obj;
+
+    if (pool->free_list) {
+        obj = pool->free_list;
+        pool->free_list = *(void **)obj;
+    }
+    else {
+        if (pool->cur >= pool->end) {
+            if (rb_mempool_grow(pool) != 0) {
+                return NULL;
+            }
+        }
+        obj = pool->cur;
+        pool->cur += pool->obj_size;
+        pool->objs_total++;
+    }
+
+    pool->objs_used++;
+    return obj;
+}
+
+void rb_mempool_free(struct rb_mempool *pool, void *obj)
+{
+    if (NULL == obj) {
+        return;
+    }
+
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->objs_used--;
+}
+
+void rb_mempool_stats(const struct rb_mempool *pool,
+            struct rb_mempool_stats *stats)
+{
+    const struct rb_mempool_chunk *chunk;
+
+    memset(stats, 0, sizeof(*stats));
+    if (NULL == pool) {
+        return;
+    }
+
+    stats->page_size = page_sizes[pool->page];
+    for (chunk = pool->chunks; chunk != NULL; chunk = chunk->next) {
+        stats->mapped_bytes += chunk->len;
+        if (chunk->page != RB_PAGE_4K) {
+            stats->huge_pages += chunk->len / page_sizes[chunk->page];
+        }
+        else {
+            stats->small_pages += chunk->len / page_sizes[RB_PAGE_4K];
+            if (chunk->thp) {
+                stats->thp_bytes += chunk->len;
+            }
+        }
+    }
+    stats->obj_size = pool->obj_size;
+    stats->objs_total = pool->objs_total;
+    stats->objs_used = pool->objs_used;
+    stats->numa_node = pool->numa_node;
+    stats->numa_bound = pool->numa_bound;
+}
+
+int rb_numa_online(int *nodes, int max)
+{
+    char buf[4096];
+    char *p, *end;
+    FILE *fp;
+    long first, last;
+    int count = 0;
+
+    /* a list of ranges, "0", "0-1" or "0-1,3" */
+    fp = fopen("/sys/devices/system/node/online", "r");
+    if ((NULL == fp) || (NULL == fgets(buf, sizeof(buf), fp))) {
+        if (fp) {
+            fclose(fp);
+        }
+        if (nodes && (max > 0)) {
+            nodes[0] = 0;
+        }
+        return 1;
+    }
+    fclose(fp);
+
+    p = buf;
+    for (;;) {
+        first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        last = first;
+        p = end;
+        if ('-' == *p) {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1) {
+                break;
+            }
+            p = end;
+        }
+        for (; first <= last; first++) {
+            if (nodes && (count < max)) {
+                nodes[count] = (int)first;
+            }
+            count++;
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+
+    if (0 == count) {
+        if (nodes && (max > 0)) {
+            nodes[0] = 0;
+        }
+        count = 1;
+    }
+    return count;
+}
+
+int rb_numa_node_count(void)
+{
+    return rb_numa_online(NULL, 0);
+}
+
+int rb_numa_current_node(void)
+{
+    unsigned int cpu;
+    unsigned int node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+        return 0;
+    }
+    return (int)node;
+}
@@ -0,0 +1,199 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_MEMPOOL_H
+#define	___RB_MEMPOOL_H
+
+#include "rbtree.h"
+
+/* page type of the pool chunks */
+#define RB_PAGE_4K      0
+#define RB_PAGE_2M      1
+#define RB_PAGE_1G      2
+
+/* no NUMA binding, memory follows the first touch policy */
+#define RB_NUMA_ANY     (-1)
+
+/*
+  node pool
+  Fixed size objects carved out of large mmap chunks. The chunks are
+  reserved with explicit huge pages (MAP_HUGETLB) when possible, else
+  with normal pages advised as transparent huge pages, else with plain
+  4K pages. Every chunk is bound to numa_node before it is touched.
+  The pool is not thread safe, same as the rule tables.
+ */
+struct rb_mempool_chunk {
+    struct rb_mempool_chunk *next;
+    unsigned long            len;       /* mapped length */
+    int                      page;      /* page type actually obtained */
+    int                      thp;       /* 4K pages advised as THP */
+};
+
+struct rb_mempool {
+    unsigned long            obj_size;  /* rounded object size */
+    unsigned long            chunk_size;/* bytes of each new chunk */
+    int                      page;      /* requested page type */
+    int                      numa_node; /* RB_NUMA_ANY for no binding */
+    int                      numa_bound;/* all chunks bound successfully */
+    void                    *free_list; /* released objects */
+    char                    *cur;       /* bump area of the newest chunk */
+    char                    *end;
+    struct rb_mempool_chunk *chunks;
+    unsigned long            objs_total;
+    unsigned long            objs_used;
+};
+
+struct rb_mempool_stats {
+    unsigned long  page_size;       /* page size requested */
+    unsigned long  huge_pages;      /* explicit huge pages mapped */
+    unsigned long  thp_bytes;       /* normal pages advised as THP */
+    unsigned long  small_pages;     /* plain 4K pages mapped */
+    unsigned long  mapped_bytes;
+    unsigned long  obj_size;
+    unsigned long  objs_total;      /* objects carved from the chunks */
+    unsigned long  objs_used;
+    int            numa_node;
+    int            numa_bound;
+};
+
+/*
+  node pool create function
+  obj_size : object size, must be more than sizeof(struct rule_tpl)
+  nr_objs  : objects to reserve in the first chunk, the pool grows by
+             chunks of the same size when it runs out.
+  page     : RB_PAGE_4K, RB_PAGE_2M or RB_PAGE_1G
+  numa_node: the node to bind the memory, or RB_NUMA_ANY
+ */
+extern struct rb_mempool *rb_mempool_create(unsigned long obj_size,
+            unsigned long nr_objs, int page, int numa_node);
+extern void rb_mempool_destroy(struct rb_mempool *pool);
+extern void *rb_mempool_alloc(struct rb_mempool *pool);
+extern void rb_mempool_free(struct rb_mempool *pool, void *obj);
+extern void rb_mempool_stats(const struct rb_mempool *pool,
+            struct rb_mempool_stats *stats);
+
+/*
+  NUMA topology helpers, node 0 is reported on non NUMA systems.
+  rb_numa_online() fills nodes with at most max online node ids, which
+  may have holes ("0-1,3"), and returns the number of online nodes.
+ */
+extern int rb_numa_online(int *nodes, int max);
+extern int rb_numa_node_count(void);
+extern int rb_numa_current_node(void);
+
+/*
+  rule templet create function, node memory from the pool.
+  root: the rb_root of actual table to be insert.
+  id  : the id of actual table
+  pool: the node pool, pool->obj_size is the size of actual table
+ */
+static inline void *
+rule_tpl_pool_create(struct rb_root *root, unsigned int id,
+                     struct rb_mempool *pool)
+{
+    struct rule_tpl *tpl;
+
+    if ((NULL == root) || (NULL == pool)) {
+        return NULL;
+    }
+
+    tpl = (struct rule_tpl *)rb_mempool_alloc(pool);
+    if (NULL == tpl) {
+        return NULL;
+    }
+    memset(tpl, 0, pool->obj_size);
+
+    tpl->id = id;
+    if (rule_tpl_insert(root, tpl) != 0) {
+        rb_mempool_free(pool, tpl);
+        return NULL;
+    }
+    return (void *)tpl;
+}
+
+/*
+  rule templet delete function, release node memory to the pool.
+  root: the rb_root of actual table to be remove.
+  id  : the id of actual table
+ */
+static inline int
+rule_tpl_pool_delete(struct rb_root *root, unsigned int id,
+                     TPL_FREE tpl_free, struct rb_mempool *pool)
+{
+    struct rb_node *node;
+
+    if ((NULL == root) || (NULL == pool)) {
+        return -1;
+    }
+
+    node = (struct rb_node *)rule_tpl_search(root, id);
+    if (NULL == node) {
+        return -1;
+    }
+
+    rb_erase(node, root);
+    if (tpl_free) {
+        tpl_free(node);
+    }
+    rb_mempool_free(pool, node);
+    return 0;
+}
+
+static inline void
+rule_tpl_pool_node_clear(struct rb_node *node, TPL_FREE tpl_free,
+                         struct rb_mempool *pool)
+{
+    struct rb_node *top = node;
+    struct rb_node *parent;
+
+    /* same walk as rule_tpl_node_clear() */
+    while (node) {
+        if (node->rb_left) {
+            node = node->rb_left;
+        }
+        else if (node->rb_right) {
+            node = node->rb_right;
+        }
+        else {
+            parent = (node == top) ? NULL : rb_parent(node);
+            if (parent) {
+                if (parent->rb_left == node) {
+                    parent->rb_left = NULL;
+                }
+                else {
+                    parent->rb_right = NULL;
+                }
+            }
+            if (tpl_free) {
+                tpl_free(node);
+            }
+            rb_mempool_free(pool, node);
+            node = parent;
+        }
+    }
+}
+
+/*
+  rule templet tree clear function, release node memory to the pool.
+  root: the rb_root of rb_tree
+  tpl_free: the free function, if there are some resources to release
+ */
+static inline int
+rule_tpl_pool_tree_clear(struct rb_root *root, TPL_FREE tpl_free,
+                         struct rb_mempool *pool)
+{
+    if ((NULL == root) || (NULL == pool)) {
+        return -1;
+    }
+
+    rule_tpl_pool_node_clear(root->rb_node, tpl_free, pool);
+    root->rb_node = NULL;
+    return 0;
+}
+
+#endif	/* ___RB_MEMPOOL_H */
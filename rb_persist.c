@@ -0,0 +1,607 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Persistent red black tree, the rebalancing of rbtree.c done on a
+ * stack of the copied path instead of parent pointers.
+ */
+#include "rb_persist.h"
+
+/* tree height can not exceed 2 * log2(n + 1) */
+#define RB_PATH_MAX     128
+
+#define pnode_is_red(n)     ((n) && ((n)->color == RB_RED))
+#define pnode_is_black(n)   (!pnode_is_red(n))
+#define pnode_is_shared(n)  ((n) && ((n)->refcnt > 1))
+
+/*
+  copies reserved before a rebalance, which must not fail half way.
+  A fixup touches at most one node per level and a few at the end.
+ */
+struct pnode_spare {
+    int                  nr;
+    struct rb_pnode     *node[RB_PATH_MAX + 4];
+};
+
+static inline void pnode_get(struct rb_pnode *node)
+{
+    if (node) {
+        __atomic_add_fetch(&node->refcnt, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void pnode_put(struct rb_pnode *node)
+{
+    struct rb_pnode *right;
+
+    while (node) {
+        if (__atomic_sub_fetch(&node->refcnt, 1, __ATOMIC_ACQ_REL) != 0) {
+            return;
+        }
+        /* recurse on one side only, loop on the other */
+        right = node->rb_right;
+        pnode_put(node->rb_left);
+        free(node);
+        node = right;
+    }
+}
+
+static int pnode_spare_alloc(struct pnode_spare *spare, int nr,
+            unsigned long size)
+{
+    spare->nr = 0;
+    while (spare->nr < nr) {
+        spare->node[spare->nr] = (struct rb_pnode *)malloc(size);
+        if (NULL == spare->node[spare->nr]) {
+            while (spare->nr > 0) {
+                free(spare->node[--spare->nr]);
+            }
+            return -1;
+        }
+        spare->nr++;
+    }
+    return 0;
+}
+
+static void pnode_spare_free(struct pnode_spare *spare)
+{
+    while (spare->nr > 0) {
+        free(spare->node[--spare->nr]);
+    }
+}
+
+/*
+  Make *link private to the tree being updated, *link's parent must
+  already be private. A shared node is copied, the copy takes a new
+  reference on both children. The copy comes from spare if given, a
+  spare sized by pnode_insert_spares()/pnode_erase_spares() never
+  runs out.
+ */
+static struct rb_pnode *pnode_own(struct rb_pnode **link, unsigned long size,
+            struct pnode_spare *spare)
+{
+    struct rb_pnode *node = *link;
+    struct rb_pnode *copy;
+
+    if ((NULL == node) ||
+        (__atomic_load_n(&node->refcnt, __ATOMIC_ACQUIRE) == 1)) {
+        return node;
+    }
+
+    if (spare && spare->nr) {
+        copy = spare->node[--spare->nr];
+    }
+    else {
+        copy = (struct rb_pnode *)malloc(size);
+    }
+    if (NULL == copy) {
+        return NULL;
+    }
+    memcpy(copy, node, size);
+    copy->refcnt = 1;
+    pnode_get(copy->rb_left);
+    pnode_get(copy->rb_right);
+
+    /* the old node keeps the references of the other versions */
+    __atomic_sub_fetch(&node->refcnt, 1, __ATOMIC_ACQ_REL);
+    *link = copy;
+    return copy;
+}
+
+static inline struct rb_pnode **
+pnode_link(struct rule_tpl_ptree *tree, struct rb_pnode **path, int i)
+{
+    if (0 == i) {
+        return &tree->root;
+    }
+    return (path[i - 1]->rb_left == path[i]) ?
+        &path[i - 1]->rb_left : &path[i - 1]->rb_right;
+}
+
+static void pnode_rotate_left(struct rb_pnode *node, struct rb_pnode **link)
+{
+    struct rb_pnode *right = node->rb_right;
+
+    node->rb_right = right->rb_left;
+    right->rb_left = node;
+    *link = right;
+}
+
+static void pnode_rotate_right(struct rb_pnode *node, struct rb_pnode **link)
+{
+    struct rb_pnode *left = node->rb_left;
+
+    node->rb_left = left->rb_right;
+    left->rb_right = node;
+    *link = left;
+}
+
+/*
+  Read only descent to id. Return the depth of the node of id, or
+  -(depth + 1) of the empty link when id is not found.
+ */
+static int pnode_find(const struct rule_tpl_ptree *tree, unsigned int id)
+{
+    struct rb_pnode *node = tree->root;
+    struct rule_tpl_pnode *cur;
+    int depth = 0;
+
+    while (node) {
+        cur = container_of(node, struct rule_tpl_pnode, node);
+        if (cur->id < id) {
+            node = node->rb_left;
+        }
+        else if (cur->id > id) {
+            node = node->rb_right;
+        }
+        else {
+            return depth;
+        }
+        depth++;
+    }
+    return -(depth + 1);
+}
+
+/*
+  Copy the path to id, path[0] is the root, only once pnode_find()
+  told the update will happen. Same return as pnode_find(), or
+  RB_PATH_MAX on no memory, the copies made are left in the tree,
+  which is still valid.
+ */
+static int pnode_path(struct rule_tpl_ptree *tree, unsigned int id,
+            struct rb_pnode **path)
+{
+    struct rb_pnode **link = &tree->root;
+    struct rule_tpl_pnode *cur;
+    int depth = 0;
+
+    while (*link) {
+        path[depth] = pnode_own(link, tree->size, NULL);
+        if (NULL == path[depth]) {
+            return RB_PATH_MAX;
+        }
+        cur = container_of(path[depth], struct rule_tpl_pnode, node);
+        if (cur->id < id) {
+            link = &path[depth]->rb_left;
+        }
+        else if (cur->id > id) {
+            link = &path[depth]->rb_right;
+        }
+        else {
+            return depth;
+        }
+        depth++;
+    }
+    return -(depth + 1);
+}
+
+/*
+  copies needed by pnode_insert_color() for a new node at path[i], the
+  recolored uncles. Colors are read before the fixup changes them,
+  which it never does above the current level.
+ */
+static int pnode_insert_spares(struct rb_pnode **path, int i)
+{
+    struct rb_pnode *parent, *gparent, *uncle;
+    int nr = 0;
+
+    while ((i >= 2) && pnode_is_red(path[i - 1])) {
+        parent = path[i - 1];
+        gparent = path[i - 2];
+        uncle = (parent == gparent->rb_left) ?
+                gparent->rb_right : gparent->rb_left;
+        if (!pnode_is_red(uncle)) {
+            break;
+        }
+        nr += pnode_is_shared(uncle);
+        i -= 2;
+    }
+    return nr;
+}
+
+static void pnode_insert_color(struct rule_tpl_ptree *tree,
+            struct rb_pnode **path, int i, struct pnode_spare *spare)
+{
+    struct rb_pnode *node, *parent, *gparent, *uncle;
+
+    while ((i >= 2) && pnode_is_red(path[i - 1]))
+    {
+        node = path[i];
+        parent = path[i - 1];
+        gparent = path[i - 2];
+
+        if (parent == gparent->rb_left)
+        {
+            uncle = gparent->rb_right;
+            if (pnode_is_red(uncle))
+            {
+                uncle = pnode_own(&gparent->rb_right, tree->size, spare);
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                i -= 2;
+                continue;
+            }
+
+            if (parent->rb_right == node)
+            {
+                pnode_rotate_left(parent, &gparent->rb_left);
+                parent = node;
+            }
+
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            pnode_rotate_right(gparent, pnode_link(tree, path, i - 2));
+        } else {
+            uncle = gparent->rb_left;
+            if (pnode_is_red(uncle))
+            {
+                uncle = pnode_own(&gparent->rb_left, tree->size, spare);
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                i -= 2;
+                continue;
+            }
+
+            if (parent->rb_left == node)
+            {
+                pnode_rotate_right(parent, &gparent->rb_right);
+                parent = node;
+            }
+
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            pnode_rotate_left(gparent, pnode_link(tree, path, i - 2));
+        }
+        break;
+    }
+
+    tree->root->color = RB_BLACK;
+}
+
+/*
+  copies needed by pnode_erase_color(), same walk without writing.
+  node (may be NULL) is on the left of path[i] if left is set. Only
+  the siblings and their children are copied, the sibling goes red or
+  the walk stops, so the colors up the path are the ones read here.
+ */
+static int pnode_erase_spares(struct rb_pnode **path, int i, int left,
+            struct rb_pnode *node)
+{
+    struct rb_pnode *other, *near, *far;
+    int shared;
+    int nr = 0;
+
+    while (pnode_is_black(node) && (i >= 0)) {
+        other = left ? path[i]->rb_right : path[i]->rb_left;
+        shared = pnode_is_shared(other);
+        nr += shared;
+        if (pnode_is_red(other)) {
+            /* rotated up, its near child is the new sibling */
+            near = left ? other->rb_left : other->rb_right;
+            shared = shared || pnode_is_shared(near);
+            nr += shared;
+            other = near;
+            if (pnode_is_black(other->rb_left) &&
+                pnode_is_black(other->rb_right)) {
+                /* parent is red now, the walk stops there */
+                break;
+            }
+        }
+        else if (pnode_is_black(other->rb_left) &&
+                 pnode_is_black(other->rb_right)) {
+            node = path[i--];
+            if (i >= 0) {
+                left = (path[i]->rb_left == node);
+            }
+            continue;
+        }
+
+        near = left ? other->rb_left : other->rb_right;
+        far = left ? other->rb_right : other->rb_left;
+        if (pnode_is_black(far)) {
+            /* near goes up, its new far child is the private sibling */
+            nr += shared || pnode_is_shared(near);
+        }
+        else {
+            nr += shared || pnode_is_shared(far);
+        }
+        break;
+    }
+    return nr;
+}
+
+/*
+  node (may be NULL) took the place of a black node, path[i] is its
+  parent. All of path[0..i] are private.
+ */
+static void pnode_erase_color(struct rule_tpl_ptree *tree,
+            struct rb_pnode **path, int i, struct rb_pnode *node,
+            struct pnode_spare *spare)
+{
+    struct rb_pnode *parent, *other;
+
+    while (pnode_is_black(node) && (node != tree->root))
+    {
+        parent = path[i];
+        if (parent->rb_left == node)
+        {
+            other = pnode_own(&parent->rb_right, tree->size, spare);
+            if (pnode_is_red(other))
+            {
+                other->color = RB_BLACK;
+                parent->color = RB_RED;
+                pnode_rotate_left(parent, pnode_link(tree, path, i));
+                /* other took the place of parent */
+                path[i] = other;
+                path[++i] = parent;
+                other = pnode_own(&parent->rb_right, tree->size, spare);
+            }
+            if (pnode_is_black(other->rb_left) &&
+                pnode_is_black(other->rb_right))
+            {
+                other->color = RB_RED;
+                node = parent;
+                i--;
+            }
+            else
+            {
+                if (pnode_is_black(other->rb_right))
+                {
+                    pnode_own(&other->rb_left, tree->size, spare)->color = RB_BLACK;
+                    other->color = RB_RED;
+                    pnode_rotate_right(other, &parent->rb_right);
+                    other = parent->rb_right;
+                }
+                other->color = parent->color;
+                parent->color = RB_BLACK;
+                pnode_own(&other->rb_right, tree->size, spare)->color = RB_BLACK;
+                pnode_rotate_left(parent, pnode_link(tree, path, i));
+                node = tree->root;
+                break;
+            }
+        }
+        else
+        {
+            other = pnode_own(&parent->rb_left, tree->size, spare);
+            if (pnode_is_red(other))
+            {
+                other->color = RB_BLACK;
+                parent->color = RB_RED;
+                pnode_rotate_right(parent, pnode_link(tree, path, i));
+                path[i] = other;
+                path[++i] = parent;
+                other = pnode_own(&parent->rb_left, tree->size, spare);
+            }
+            if (pnode_is_black(other->rb_left) &&
+                pnode_is_black(other->rb_right))
+            {
+                other->color = RB_RED;
+                node = parent;
+                i--;
+            }
+            else
+            {
+                if (pnode_is_black(other->rb_left))
+                {
+                    pnode_own(&other->rb_right, tree->size, spare)->color = RB_BLACK;
+                    other->color = RB_RED;
+                    pnode_rotate_left(other, &parent->rb_left);
+                    other = parent->rb_left;
+                }
+                other->color = parent->color;
+                parent->color = RB_BLACK;
+                pnode_own(&other->rb_left, tree->size, spare)->color = RB_BLACK;
+                pnode_rotate_right(parent, pnode_link(tree, path, i));
+                node = tree->root;
+                break;
+            }
+        }
+    }
+    if (node)
+        node->color = RB_BLACK;
+}
+
+void rule_tpl_ptree_snapshot(struct rule_tpl_ptree *tree,
+            struct rule_tpl_ptree *snap)
+{
+    if ((NULL == tree) || (NULL == snap)) {
+        return;
+    }
+
+    pnode_get(tree->root);
+    *snap = *tree;
+}
+
+void rule_tpl_ptree_release(struct rule_tpl_ptree *tree)
+{
+    if (NULL == tree) {
+        return;
+    }
+
+    pnode_put(tree->root);
+    tree->root = NULL;
+    tree->count = 0;
+}
+
+void *rule_tpl_ptree_create(struct rule_tpl_ptree *tree, unsigned int id)
+{
+    struct rb_pnode *path[RB_PATH_MAX];
+    struct pnode_spare spare;
+    struct rule_tpl_pnode *tpl;
+    int depth;
+
+    if ((NULL == tree) || (tree->size < sizeof(struct rule_tpl_pnode))) {
+        return NULL;
+    }
+
+    /* an existing id copies nothing */
+    if (pnode_find(tree, id) >= 0) {
+        return NULL;
+    }
+    depth = pnode_path(tree, id, path);
+    if (depth >= 0) {
+        /* no memory */
+        return NULL;
+    }
+    depth = -depth - 1;
+
+    tpl = (struct rule_tpl_pnode *)malloc(tree->size);
+    if (NULL == tpl) {
+        return NULL;
+    }
+    if (pnode_spare_alloc(&spare, pnode_insert_spares(path, depth),
+                          tree->size) != 0) {
+        free(tpl);
+        return NULL;
+    }
+    memset(tpl, 0, tree->size);
+    tpl->id = id;
+    tpl->node.refcnt = 1;
+    tpl->node.color = RB_RED;
+
+    path[depth] = &tpl->node;
+    if (0 == depth) {
+        tree->root = &tpl->node;
+    }
+    else if (container_of(path[depth - 1], struct rule_tpl_pnode, node)->id < id) {
+        path[depth - 1]->rb_left = &tpl->node;
+    }
+    else {
+        path[depth - 1]->rb_right = &tpl->node;
+    }
+    pnode_insert_color(tree, path, depth, &spare);
+    pnode_spare_free(&spare);
+    tree->count++;
+    return (void *)tpl;
+}
+
+void *rule_tpl_ptree_modify(struct rule_tpl_ptree *tree, unsigned int id)
+{
+    struct rb_pnode *path[RB_PATH_MAX];
+    int depth;
+
+    if (NULL == tree) {
+        return NULL;
+    }
+
+    if (pnode_find(tree, id) < 0) {
+        return NULL;
+    }
+    depth = pnode_path(tree, id, path);
+    if ((depth < 0) || (depth >= RB_PATH_MAX)) {
+        return NULL;
+    }
+    return (void *)path[depth];
+}
+
+int rule_tpl_ptree_delete(struct rule_tpl_ptree *tree, unsigned int id)
+{
+    struct rb_pnode *path[RB_PATH_MAX];
+    struct pnode_spare spare;
+    struct rb_pnode *node, *succ, *child;
+    struct rb_pnode **link, **next;
+    unsigned int color;
+    int depth, d, left, nr;
+
+    if (NULL == tree) {
+        return -1;
+    }
+
+    if (pnode_find(tree, id) < 0) {
+        return -1;
+    }
+    depth = pnode_path(tree, id, path);
+    if ((depth < 0) || (depth >= RB_PATH_MAX)) {
+        return -1;
+    }
+    node = path[depth];
+    d = depth;
+
+    /* the unlinked slot: node itself, or its successor */
+    succ = node;
+    if (node->rb_left && node->rb_right) {
+        next = &node->rb_right;
+        do {
+            succ = pnode_own(next, tree->size, NULL);
+            if (NULL == succ) {
+                return -1;
+            }
+            path[++depth] = succ;
+            next = &succ->rb_left;
+        } while (*next);
+    }
+    child = succ->rb_left ? succ->rb_left : succ->rb_right;
+    color = succ->color;
+    left = (depth > 0) && (path[depth - 1]->rb_left == succ);
+
+    /* reserve the copies of the rebalance before the tree is changed */
+    nr = 0;
+    if (RB_BLACK == color) {
+        nr = pnode_is_red(child) ? pnode_is_shared(child) :
+             pnode_erase_spares(path, depth - 1, left, child);
+    }
+    if (pnode_spare_alloc(&spare, nr, tree->size) != 0) {
+        return -1;
+    }
+
+    if (succ == node) {
+        link = pnode_link(tree, path, depth);
+        *link = child;
+    }
+    else {
+        /* the successor takes the place and color of node, as rb_erase */
+        if (depth == d + 1) {
+            link = &succ->rb_right;
+        }
+        else {
+            link = &path[depth - 1]->rb_left;
+            *link = child;
+            succ->rb_right = node->rb_right;
+        }
+        succ->rb_left = node->rb_left;
+        succ->color = node->color;
+        *pnode_link(tree, path, d) = succ;
+        path[d] = succ;
+    }
+
+    if (RB_BLACK == color) {
+        if (pnode_is_red(child)) {
+            pnode_own(link, tree->size, &spare)->color = RB_BLACK;
+        }
+        else {
+            pnode_erase_color(tree, path, depth - 1, child, &spare);
+        }
+    }
+    pnode_spare_free(&spare);
+
+    /* the child references moved to the successor, free the node only */
+    free(node);
+    tree->count--;
+    return 0;
+}
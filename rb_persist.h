@@ -0,0 +1,105 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_PERSIST_H
+#define	___RB_PERSIST_H
+
+#include "rbtree.h"
+
+/*
+  persistent (path copying) red black tree
+  Nodes are reference counted and shared between versions of the tree.
+  An update copies only the shared nodes on its path, O(log n), so a
+  snapshot is just one more reference on the root, O(1). There is no
+  parent pointer, a node may have several parents.
+  The payload is copied with memcpy, it must not own resources.
+ */
+struct rb_pnode
+{
+	struct rb_pnode *rb_right;
+	struct rb_pnode *rb_left;
+	unsigned int     refcnt;
+	unsigned int     color;
+};
+
+/* The actual table must be in struct of rule_tpl_pnode, as rule_tpl */
+struct rule_tpl_pnode {
+    struct rb_pnode      node;
+    unsigned int         id;
+};
+
+/* a version of the table, the working tree or a snapshot */
+struct rule_tpl_ptree {
+    struct rb_pnode     *root;
+    unsigned long        size;  /* size of actual table */
+    unsigned long        count;
+};
+
+/*
+  persistent table init function
+  size: the size of actual table, must be more than sizeof(struct rule_tpl_pnode)
+ */
+static inline void
+rule_tpl_ptree_init(struct rule_tpl_ptree *tree, unsigned long size)
+{
+    tree->root = NULL;
+    tree->size = size;
+    tree->count = 0;
+}
+
+/* O(1) snapshot, snap may be updated too, it becomes a branch */
+extern void rule_tpl_ptree_snapshot(struct rule_tpl_ptree *tree,
+            struct rule_tpl_ptree *snap);
+/* drop a version, nodes not shared with other versions are freed */
+extern void rule_tpl_ptree_release(struct rule_tpl_ptree *tree);
+
+/*
+  updates, the returned node is private to the tree and may be written
+  until the next snapshot of the tree. An update of nothing (create of
+  an existing id, modify or delete of a missing one) copies nothing,
+  and no memory shortage leaves the tree unbalanced: the copies of the
+  rebalance are reserved before the tree is changed. Delete frees only
+  the node of id, the nodes of other ids keep their address.
+ */
+extern void *rule_tpl_ptree_create(struct rule_tpl_ptree *tree,
+            unsigned int id);
+extern void *rule_tpl_ptree_modify(struct rule_tpl_ptree *tree,
+            unsigned int id);
+extern int rule_tpl_ptree_delete(struct rule_tpl_ptree *tree,
+            unsigned int id);
+
+/*
+  persistent table search function, any version.
+  the returned node is shared with other versions, read only.
+ */
+static inline const void *
+rule_tpl_ptree_search(const struct rule_tpl_ptree *tree, unsigned int id)
+{
+    struct rb_pnode *node;
+
+    if (NULL == tree) {
+        return NULL;
+    }
+
+    node = tree->root;
+    while (node != NULL) {
+        struct rule_tpl_pnode *cur = container_of(node, struct rule_tpl_pnode, node);
+        if (cur->id < id) {
+            node = node->rb_left;
+        }
+        else if (cur->id > id) {
+            node = node->rb_right;
+        }
+        else {
+            return (const void *)node;
+        }
+    }
+    return NULL;
+}
+
+#endif	/* ___RB_PERSIST_H */
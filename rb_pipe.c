@@ -0,0 +1,357 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Asynchronous batched update pipeline with atomic publish.
+ */
+#include <sched.h>
+#include "rb_pipe.h"
+
+static int rb_pipe_op_cmp(const void *a, const void *b)
+{
+    const struct rule_tpl_pipe_op *oa = *(struct rule_tpl_pipe_op * const *)a;
+    const struct rule_tpl_pipe_op *ob = *(struct rule_tpl_pipe_op * const *)b;
+
+    /* tree order first, bigger id on the left, then enqueue order */
+    if (oa->id != ob->id) {
+        return (oa->id > ob->id) ? -1 : 1;
+    }
+    if (oa->seq != ob->seq) {
+        return (oa->seq < ob->seq) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* release what the payload of a dropped SET owns */
+static void rb_pipe_op_free(struct rule_tpl_pipe *pipe,
+            struct rule_tpl_pipe_op *op)
+{
+    if ((RB_PIPE_SET == op->op) && pipe->tpl_free) {
+        pipe->tpl_free((struct rb_node *)op->data);
+    }
+    free(op);
+}
+
+/*
+  Apply one change to a copy of the table, searching from finger, the
+  node of the previous change. The shadow copy gets a deep copy of a
+  SET payload, the retired copy, last, takes the payload itself.
+  return the node to search the next change from.
+ */
+static struct rule_tpl *rb_pipe_apply(struct rule_tpl_pipe *pipe,
+            struct rb_root *root, struct rule_tpl_pipe_op *op,
+            struct rule_tpl *finger, int last)
+{
+    struct rule_tpl *tpl;
+    struct rb_node *next;
+
+    tpl = (struct rule_tpl *)rule_tpl_finger_search(root, finger, op->id);
+    if (op->op == RB_PIPE_DEL) {
+        if (NULL == tpl) {
+            return finger;
+        }
+        /* the next changes have smaller ids, they come after tpl */
+        next = rb_next(&tpl->node);
+        if (NULL == next) {
+            next = rb_prev(&tpl->node);
+        }
+        rb_erase(&tpl->node, root);
+        if (pipe->tpl_free) {
+            pipe->tpl_free(&tpl->node);
+        }
+        free((void *)tpl);
+        return next ? container_of(next, struct rule_tpl, node) : NULL;
+    }
+
+    if (tpl) {
+        if (pipe->tpl_free) {
+            pipe->tpl_free(&tpl->node);
+        }
+    }
+    else {
+        tpl = (struct rule_tpl *)malloc(pipe->size);
+        if (NULL == tpl) {
+            if (last && pipe->tpl_free) {
+                pipe->tpl_free((struct rb_node *)op->data);
+            }
+            return finger;
+        }
+        memset(tpl, 0, pipe->size);
+        tpl->id = op->id;
+        rule_tpl_finger_insert(root, finger, tpl);
+    }
+    memcpy((char *)tpl + sizeof(struct rule_tpl),
+           op->data + sizeof(struct rule_tpl),
+           pipe->size - sizeof(struct rule_tpl));
+    if (!last && pipe->tpl_copy) {
+        pipe->tpl_copy(&tpl->node, (const struct rb_node *)op->data);
+    }
+    return tpl;
+}
+
+static int rb_pipe_batch_grow(struct rule_tpl_pipe *pipe, unsigned long n)
+{
+    struct rule_tpl_pipe_op **batch;
+    unsigned long max = pipe->batch_max ? pipe->batch_max : 256;
+
+    while (max < n) {
+        max <<= 1;
+    }
+    batch = (struct rule_tpl_pipe_op **)
+        realloc(pipe->batch, max * sizeof(*batch));
+    if (NULL == batch) {
+        return -1;
+    }
+    pipe->batch = batch;
+    pipe->batch_max = max;
+    return 0;
+}
+
+/*
+  Coalesce and publish n changes of the scratch array.
+ */
+static void rb_pipe_commit(struct rule_tpl_pipe *pipe, unsigned long n)
+{
+    struct rule_tpl *finger;
+    unsigned long keep = 0;
+    unsigned long i;
+    int old;
+
+    qsort(pipe->batch, n, sizeof(pipe->batch[0]), rb_pipe_op_cmp);
+
+    /* keep only the last change of every id */
+    for (i = 0; i < n; i++) {
+        if ((i + 1 < n) && (pipe->batch[i + 1]->id == pipe->batch[i]->id)) {
+            rb_pipe_op_free(pipe, pipe->batch[i]);
+            continue;
+        }
+        pipe->batch[keep++] = pipe->batch[i];
+    }
+    pipe->coalesced += n - keep;
+
+    /*
+      shadow copy, publish, then the retired copy, each in one pass of
+      the sorted batch
+     */
+    old = pipe->cur;
+    finger = NULL;
+    for (i = 0; i < keep; i++) {
+        finger = rb_pipe_apply(pipe, &pipe->roots[!old], pipe->batch[i],
+                               finger, 0);
+    }
+    __atomic_store_n(&pipe->cur, !old, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pipe->readers[old].count, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+    finger = NULL;
+    for (i = 0; i < keep; i++) {
+        finger = rb_pipe_apply(pipe, &pipe->roots[old], pipe->batch[i],
+                               finger, 1);
+        free(pipe->batch[i]);
+    }
+
+    pipe->batches++;
+    pipe->applied += keep;
+}
+
+/*
+  Apply the changes taken from the queue, return the number of changes.
+ */
+static unsigned long rb_pipe_run(struct rule_tpl_pipe *pipe,
+            struct rule_tpl_pipe_op *list)
+{
+    struct rule_tpl_pipe_op *prev = NULL;
+    struct rule_tpl_pipe_op *op;
+    unsigned long total = 0;
+    unsigned long n = 0;
+
+    /* the queue is a stack, restore the enqueue order */
+    while (list) {
+        op = list->next;
+        list->next = prev;
+        prev = list;
+        list = op;
+        total++;
+    }
+    if (total > pipe->batch_max) {
+        rb_pipe_batch_grow(pipe, total);
+    }
+
+    /* without memory for the whole batch, commit it in pieces */
+    for (op = prev; op != NULL; op = list) {
+        list = op->next;
+        pipe->batch[n++] = op;
+        if (n == pipe->batch_max) {
+            rb_pipe_commit(pipe, n);
+            n = 0;
+        }
+    }
+    if (n) {
+        rb_pipe_commit(pipe, n);
+    }
+    return total;
+}
+
+static void *rb_pipe_writer(void *arg)
+{
+    struct rule_tpl_pipe *pipe = (struct rule_tpl_pipe *)arg;
+    struct rule_tpl_pipe_op *list;
+    unsigned long done;
+
+    for (;;) {
+        while (sem_wait(&pipe->work) != 0) {
+            ;
+        }
+
+        list = __atomic_exchange_n(&pipe->head, NULL, __ATOMIC_ACQUIRE);
+        if (list) {
+            done = rb_pipe_run(pipe, list);
+            pthread_mutex_lock(&pipe->lock);
+            pipe->done_seq += done;
+            pthread_cond_broadcast(&pipe->done);
+            pthread_mutex_unlock(&pipe->lock);
+        }
+
+        if (__atomic_load_n(&pipe->stop, __ATOMIC_ACQUIRE) &&
+            (NULL == __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE))) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct rule_tpl_pipe *rule_tpl_pipe_alloc(unsigned long size,
+            TPL_COPY tpl_copy, TPL_FREE tpl_free)
+{
+    struct rule_tpl_pipe *pipe;
+
+    /* owned payloads are in both copies, each must own its own */
+    if ((size < sizeof(struct rule_tpl)) || (tpl_free && !tpl_copy)) {
+        return NULL;
+    }
+
+    if (posix_memalign((void **)&pipe, 64, sizeof(*pipe)) != 0) {
+        return NULL;
+    }
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->roots[0] = RB_ROOT;
+    pipe->roots[1] = RB_ROOT;
+    pipe->size = size;
+    pipe->tpl_copy = tpl_copy;
+    pipe->tpl_free = tpl_free;
+    if (rb_pipe_batch_grow(pipe, 256) != 0) {
+        free(pipe);
+        return NULL;
+    }
+
+    sem_init(&pipe->work, 0, 0);
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->done, NULL);
+    if (pthread_create(&pipe->writer, NULL, rb_pipe_writer, pipe) != 0) {
+        sem_destroy(&pipe->work);
+        pthread_mutex_destroy(&pipe->lock);
+        pthread_cond_destroy(&pipe->done);
+        free(pipe->batch);
+        free(pipe);
+        return NULL;
+    }
+    return pipe;
+}
+
+void rule_tpl_pipe_free(struct rule_tpl_pipe *pipe)
+{
+    if (NULL == pipe) {
+        return;
+    }
+
+    /* the writer drains the queue before it exits */
+    __atomic_store_n(&pipe->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&pipe->work);
+    pthread_join(pipe->writer, NULL);
+
+    rule_tpl_tree_clear(&pipe->roots[0], pipe->tpl_free);
+    rule_tpl_tree_clear(&pipe->roots[1], pipe->tpl_free);
+    sem_destroy(&pipe->work);
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->done);
+    free(pipe->batch);
+    free(pipe);
+}
+
+static int rb_pipe_enqueue(struct rule_tpl_pipe *pipe, int type,
+            unsigned int id, const void *data)
+{
+    struct rule_tpl_pipe_op *op;
+    struct rule_tpl_pipe_op *head;
+    unsigned long len = sizeof(*op);
+
+    if (type == RB_PIPE_SET) {
+        len += pipe->size;
+    }
+    op = (struct rule_tpl_pipe_op *)malloc(len);
+    if (NULL == op) {
+        return -1;
+    }
+    op->op = type;
+    op->id = id;
+    if (type == RB_PIPE_SET) {
+        if (data) {
+            memcpy(op->data, data, pipe->size);
+        }
+        else {
+            memset(op->data, 0, pipe->size);
+        }
+    }
+    op->seq = __atomic_add_fetch(&pipe->enq_seq, 1, __ATOMIC_ACQ_REL);
+
+    head = __atomic_load_n(&pipe->head, __ATOMIC_RELAXED);
+    do {
+        op->next = head;
+    } while (!__atomic_compare_exchange_n(&pipe->head, &head, op, 1,
+                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* the writer takes the whole queue, wake it up on the first one */
+    if (NULL == head) {
+        sem_post(&pipe->work);
+    }
+    return 0;
+}
+
+int rule_tpl_pipe_set(struct rule_tpl_pipe *pipe, unsigned int id,
+            const void *data)
+{
+    if (NULL == pipe) {
+        return -1;
+    }
+
+    return rb_pipe_enqueue(pipe, RB_PIPE_SET, id, data);
+}
+
+int rule_tpl_pipe_del(struct rule_tpl_pipe *pipe, unsigned int id)
+{
+    if (NULL == pipe) {
+        return -1;
+    }
+
+    return rb_pipe_enqueue(pipe, RB_PIPE_DEL, id, NULL);
+}
+
+void rule_tpl_pipe_flush(struct rule_tpl_pipe *pipe)
+{
+    unsigned long seq;
+
+    if (NULL == pipe) {
+        return;
+    }
+
+    seq = __atomic_load_n(&pipe->enq_seq, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&pipe->lock);
+    while (pipe->done_seq < seq) {
+        pthread_cond_wait(&pipe->done, &pipe->lock);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+}
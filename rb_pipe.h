@@ -0,0 +1,124 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_PIPE_H
+#define	___RB_PIPE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include "rbtree.h"
+
+/*
+  batched update pipeline of a rule table
+  Callers enqueue changes without blocking. A writer thread takes all
+  the queued changes, keeps the last one of every id, and applies them
+  in tree order to the shadow copy of the table. Then the shadow copy is
+  published to the readers with one atomic store, and once the readers
+  of the old copy are gone, the same batch is applied to the old copy,
+  which becomes the next shadow.
+  Each copy of the table owns its payloads: a SET is deep copied into
+  the shadow by tpl_copy, and moved into the retired copy. The payload
+  a SET replaces, or a DEL removes, is released by tpl_free in each
+  copy, and so is the payload of a change dropped by coalescing.
+ */
+#define RB_PIPE_SET     1   /* create, or overwrite the payload */
+#define RB_PIPE_DEL     2
+
+struct rule_tpl_pipe_op {
+    struct rule_tpl_pipe_op *next;
+    int                      op;
+    unsigned int             id;
+    unsigned long            seq;
+    char                     data[];   /* whole actual table, for SET */
+};
+
+/* readers of one copy, alone in its cache line */
+struct rule_tpl_pipe_readers {
+    long                      count;
+} __attribute__((aligned(64)));
+
+struct rule_tpl_pipe {
+    struct rb_root            roots[2];
+    int                       cur;        /* copy published to readers */
+    unsigned long             size;       /* size of actual table */
+    TPL_COPY                  tpl_copy;
+    TPL_FREE                  tpl_free;
+
+    /* off the line of roots and cur, which every reader loads */
+    struct rule_tpl_pipe_readers readers[2];
+
+    struct rule_tpl_pipe_op  *head;       /* lock free queued changes */
+    unsigned long             enq_seq;    /* changes enqueued */
+    unsigned long             done_seq;   /* changes retired */
+
+    pthread_t                 writer;
+    sem_t                     work;
+    pthread_mutex_t           lock;
+    pthread_cond_t            done;
+    int                       stop;
+
+    struct rule_tpl_pipe_op **batch;      /* writer scratch */
+    unsigned long             batch_max;
+
+    unsigned long             batches;    /* publishes */
+    unsigned long             applied;    /* changes applied */
+    unsigned long             coalesced;  /* changes dropped by coalescing */
+};
+
+/*
+  pipeline create function, starts the writer thread.
+  size    : the size of actual table, must be more than sizeof(struct rule_tpl)
+  tpl_copy: the deep copy function of a payload, may be NULL only if
+            tpl_free is NULL too, payloads then own nothing
+  tpl_free: the free function, called once for every payload
+ */
+extern struct rule_tpl_pipe *rule_tpl_pipe_alloc(unsigned long size,
+            TPL_COPY tpl_copy, TPL_FREE tpl_free);
+extern void rule_tpl_pipe_free(struct rule_tpl_pipe *pipe);
+
+/*
+  enqueue a change, never blocks on the writer.
+  data is a whole actual table, the bytes after struct rule_tpl are the
+  payload, the node and id part is ignored. What the payload owns is
+  handed over to the pipeline.
+ */
+extern int rule_tpl_pipe_set(struct rule_tpl_pipe *pipe, unsigned int id,
+            const void *data);
+extern int rule_tpl_pipe_del(struct rule_tpl_pipe *pipe, unsigned int id);
+
+/* wait until all the changes enqueued before are published */
+extern void rule_tpl_pipe_flush(struct rule_tpl_pipe *pipe);
+
+/*
+  reader side, the returned table and its nodes are valid until
+  rule_tpl_pipe_read_unlock().
+ */
+static inline struct rb_root *
+rule_tpl_pipe_read_lock(struct rule_tpl_pipe *pipe)
+{
+    int idx;
+
+    for (;;) {
+        idx = __atomic_load_n(&pipe->cur, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&pipe->readers[idx].count, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pipe->cur, __ATOMIC_SEQ_CST) == idx) {
+            return &pipe->roots[idx];
+        }
+        /* a publish came in between, the writer may own this copy */
+        __atomic_fetch_sub(&pipe->readers[idx].count, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static inline void
+rule_tpl_pipe_read_unlock(struct rule_tpl_pipe *pipe, struct rb_root *root)
+{
+    __atomic_fetch_sub(&pipe->readers[root - pipe->roots].count, 1,
+                       __ATOMIC_RELEASE);
+}
+
+#endif	/* ___RB_PIPE_H */
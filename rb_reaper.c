@@ -0,0 +1,138 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Background release of detached rule tables.
+ */
+#include <sched.h>
+#include "rb_reaper.h"
+
+#define RB_REAP_BUDGET      4096
+
+static void *rb_reaper_thread(void *arg)
+{
+    struct rule_tpl_reaper *reaper = (struct rule_tpl_reaper *)arg;
+    struct rule_tpl_reap_job *job;
+    unsigned long freed;
+
+    pthread_mutex_lock(&reaper->lock);
+    for (;;) {
+        while ((NULL == reaper->head) && !reaper->stop) {
+            pthread_cond_wait(&reaper->cond, &reaper->lock);
+        }
+        job = reaper->head;
+        if (NULL == job) {
+            break;
+        }
+        reaper->head = job->next;
+        if (NULL == reaper->head) {
+            reaper->tail = NULL;
+        }
+        reaper->busy = 1;
+        pthread_mutex_unlock(&reaper->lock);
+
+        /* yield between slices, the reaper must not hog a core */
+        while (job->root.rb_node) {
+            freed = rule_tpl_clear_step(&job->root, reaper->budget,
+                                        job->tpl_free);
+            __atomic_add_fetch(&reaper->reaped, freed, __ATOMIC_RELAXED);
+            sched_yield();
+        }
+        free(job);
+
+        pthread_mutex_lock(&reaper->lock);
+        reaper->busy = 0;
+        pthread_cond_broadcast(&reaper->cond);
+    }
+    pthread_mutex_unlock(&reaper->lock);
+    return NULL;
+}
+
+struct rule_tpl_reaper *rule_tpl_reaper_start(unsigned long budget)
+{
+    struct rule_tpl_reaper *reaper;
+
+    reaper = (struct rule_tpl_reaper *)malloc(sizeof(*reaper));
+    if (NULL == reaper) {
+        return NULL;
+    }
+    memset(reaper, 0, sizeof(*reaper));
+    reaper->budget = budget ? budget : RB_REAP_BUDGET;
+
+    pthread_mutex_init(&reaper->lock, NULL);
+    pthread_cond_init(&reaper->cond, NULL);
+    if (pthread_create(&reaper->thread, NULL, rb_reaper_thread, reaper) != 0) {
+        pthread_mutex_destroy(&reaper->lock);
+        pthread_cond_destroy(&reaper->cond);
+        free(reaper);
+        return NULL;
+    }
+    return reaper;
+}
+
+void rule_tpl_reaper_stop(struct rule_tpl_reaper *reaper)
+{
+    if (NULL == reaper) {
+        return;
+    }
+
+    pthread_mutex_lock(&reaper->lock);
+    reaper->stop = 1;
+    pthread_cond_broadcast(&reaper->cond);
+    pthread_mutex_unlock(&reaper->lock);
+    pthread_join(reaper->thread, NULL);
+
+    pthread_mutex_destroy(&reaper->lock);
+    pthread_cond_destroy(&reaper->cond);
+    free(reaper);
+}
+
+int rule_tpl_reaper_submit(struct rule_tpl_reaper *reaper,
+            struct rb_root *root, TPL_FREE tpl_free)
+{
+    struct rule_tpl_reap_job *job;
+
+    if ((NULL == reaper) || (NULL == root)) {
+        return -1;
+    }
+    if (NULL == root->rb_node) {
+        return 0;
+    }
+
+    job = (struct rule_tpl_reap_job *)malloc(sizeof(*job));
+    if (NULL == job) {
+        return -1;
+    }
+    job->next = NULL;
+    job->tpl_free = tpl_free;
+    rule_tpl_tree_detach(root, &job->root);
+
+    pthread_mutex_lock(&reaper->lock);
+    if (reaper->tail) {
+        reaper->tail->next = job;
+    }
+    else {
+        reaper->head = job;
+    }
+    reaper->tail = job;
+    pthread_cond_broadcast(&reaper->cond);
+    pthread_mutex_unlock(&reaper->lock);
+    return 0;
+}
+
+void rule_tpl_reaper_drain(struct rule_tpl_reaper *reaper)
+{
+    if (NULL == reaper) {
+        return;
+    }
+
+    pthread_mutex_lock(&reaper->lock);
+    while (reaper->head || reaper->busy) {
+        pthread_cond_wait(&reaper->cond, &reaper->lock);
+    }
+    pthread_mutex_unlock(&reaper->lock);
+}
@@ -0,0 +1,58 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_REAPER_H
+#define	___RB_REAPER_H
+
+#include <pthread.h>
+#include "rbtree.h"
+
+/*
+  background reaper of rule tables
+  A table handed to the reaper is detached at once, and the reaper
+  thread releases its nodes with rule_tpl_clear_step(), so swapping a
+  big table never stalls the caller.
+ */
+struct rule_tpl_reap_job {
+    struct rule_tpl_reap_job *next;
+    struct rb_root            root;
+    TPL_FREE                  tpl_free;
+};
+
+struct rule_tpl_reaper {
+    pthread_t                 thread;
+    pthread_mutex_t           lock;
+    pthread_cond_t            cond;
+    struct rule_tpl_reap_job *head;
+    struct rule_tpl_reap_job *tail;
+    unsigned long             budget;   /* nodes per slice */
+    int                       stop;
+    int                       busy;     /* a job is being released */
+    unsigned long             reaped;   /* nodes released */
+};
+
+/*
+  reaper start function
+  budget: the max nodes released in one slice before the lock is
+          checked again, 0 for the default
+ */
+extern struct rule_tpl_reaper *rule_tpl_reaper_start(unsigned long budget);
+/* release all the submitted tables, then stop the thread */
+extern void rule_tpl_reaper_stop(struct rule_tpl_reaper *reaper);
+
+/*
+  hand the whole table to the reaper, root is left empty.
+  return 0 if submitted, -1 on no memory, the table is left untouched.
+ */
+extern int rule_tpl_reaper_submit(struct rule_tpl_reaper *reaper,
+            struct rb_root *root, TPL_FREE tpl_free);
+
+/* wait until all the submitted tables are released */
+extern void rule_tpl_reaper_drain(struct rule_tpl_reaper *reaper);
+
+#endif	/* ___RB_REAPER_H */
@@ -0,0 +1,232 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Rule table replicated on every NUMA node.
+ * Writes are applied synchronously to all the replicas in the caller's
+ * context, so the replicas never diverge and no replay log is needed.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <unistd.h>
+#include "rb_replica.h"
+
+/* parse the sysfs cpu list, "0-3,8-11", of replica i into the cpu map */
+static void rb_replica_cpulist(struct rule_tpl_replica *rep, int i)
+{
+    char path[64];
+    FILE *fp;
+    int first;
+    int last;
+    int cpu;
+    int sep;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             rep->nodes[i].node);
+    fp = fopen(path, "r");
+    if (NULL == fp) {
+        return;
+    }
+
+    while (fscanf(fp, "%d", &first) == 1) {
+        last = first;
+        sep = fgetc(fp);
+        if (sep == '-') {
+            if (fscanf(fp, "%d", &last) != 1) {
+                break;
+            }
+            sep = fgetc(fp);
+        }
+        for (cpu = first; (cpu <= last) && (cpu < rep->nr_cpus); cpu++) {
+            rep->cpu_node[cpu] = i;
+        }
+        if (sep != ',') {
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+struct rule_tpl_replica *rule_tpl_replica_alloc(unsigned long size,
+            unsigned long nr_objs, int page)
+{
+    struct rule_tpl_replica *rep;
+    int *node_ids;
+    int i;
+
+    if (size < sizeof(struct rule_tpl)) {
+        return NULL;
+    }
+
+    rep = (struct rule_tpl_replica *)malloc(sizeof(*rep));
+    if (NULL == rep) {
+        return NULL;
+    }
+    memset(rep, 0, sizeof(*rep));
+    rep->size = size;
+    rep->nr_nodes = rb_numa_node_count();
+    node_ids = (int *)malloc(rep->nr_nodes * sizeof(int));
+    if (NULL == node_ids) {
+        free(rep);
+        return NULL;
+    }
+    /* a node put online in between is left out */
+    i = rb_numa_online(node_ids, rep->nr_nodes);
+    if (i < rep->nr_nodes) {
+        rep->nr_nodes = i;
+    }
+    rep->nr_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (rep->nr_cpus <= 0) {
+        rep->nr_cpus = 1;
+    }
+
+    rep->cpu_node = (int *)malloc(rep->nr_cpus * sizeof(int));
+    if (posix_memalign((void **)&rep->nodes, 64,
+                       rep->nr_nodes * sizeof(*rep->nodes)) != 0) {
+        rep->nodes = NULL;
+    }
+    if ((NULL == rep->cpu_node) || (NULL == rep->nodes)) {
+        goto fail;
+    }
+
+    /* the cpus of no online node stay on the first replica */
+    memset(rep->cpu_node, 0, rep->nr_cpus * sizeof(int));
+    memset(rep->nodes, 0, rep->nr_nodes * sizeof(*rep->nodes));
+    for (i = 0; i < rep->nr_nodes; i++) {
+        rep->nodes[i].node = node_ids[i];
+    }
+    free(node_ids);
+    node_ids = NULL;
+
+    for (i = 0; i < rep->nr_nodes; i++) {
+        rb_replica_cpulist(rep, i);
+        rep->nodes[i].root = RB_ROOT;
+        /* one node needs no binding, else a copy must sit on its node */
+        rep->nodes[i].pool = rb_mempool_create(size, nr_objs, page,
+                (rep->nr_nodes > 1) ? rep->nodes[i].node : RB_NUMA_ANY);
+        if (NULL == rep->nodes[i].pool) {
+            goto fail;
+        }
+        if ((rep->nr_nodes > 1) && !rep->nodes[i].pool->numa_bound) {
+            goto fail;
+        }
+    }
+    return rep;
+
+fail:
+    free(node_ids);
+    rule_tpl_replica_free(rep, NULL);
+    return NULL;
+}
+
+void rule_tpl_replica_free(struct rule_tpl_replica *rep, TPL_FREE tpl_free)
+{
+    int i;
+
+    if (NULL == rep) {
+        return;
+    }
+
+    if (rep->nodes) {
+        for (i = 0; i < rep->nr_nodes; i++) {
+            if (rep->nodes[i].pool) {
+                rule_tpl_pool_tree_clear(&rep->nodes[i].root, tpl_free,
+                                         rep->nodes[i].pool);
+                rb_mempool_destroy(rep->nodes[i].pool);
+            }
+        }
+        free(rep->nodes);
+    }
+    free(rep->cpu_node);
+    free(rep);
+}
+
+static void rb_replica_copy(struct rule_tpl_replica *rep,
+            struct rule_tpl *tpl, const void *data)
+{
+    if (data && (rep->size > sizeof(struct rule_tpl))) {
+        memcpy((char *)tpl + sizeof(struct rule_tpl),
+               (const char *)data + sizeof(struct rule_tpl),
+               rep->size - sizeof(struct rule_tpl));
+    }
+}
+
+int rule_tpl_replica_create(struct rule_tpl_replica *rep,
+            unsigned int id, const void *data)
+{
+    struct rule_tpl *tpl;
+    int i;
+
+    if (NULL == rep) {
+        return -1;
+    }
+
+    for (i = 0; i < rep->nr_nodes; i++) {
+        tpl = (struct rule_tpl *)rule_tpl_pool_create(&rep->nodes[i].root,
+                                    id, rep->nodes[i].pool);
+        if (NULL == tpl) {
+            /* exists or no memory, undo the replicas done so far */
+            while (--i >= 0) {
+                rule_tpl_pool_delete(&rep->nodes[i].root, id, NULL,
+                                     rep->nodes[i].pool);
+            }
+            return -1;
+        }
+        rb_replica_copy(rep, tpl, data);
+    }
+    return 0;
+}
+
+int rule_tpl_replica_update(struct rule_tpl_replica *rep,
+            unsigned int id, const void *data)
+{
+    struct rule_tpl *tpl;
+    int i;
+
+    if (NULL == rep) {
+        return -1;
+    }
+
+    for (i = 0; i < rep->nr_nodes; i++) {
+        tpl = (struct rule_tpl *)rule_tpl_search(&rep->nodes[i].root, id);
+        if (NULL == tpl) {
+            return -1;
+        }
+        rb_replica_copy(rep, tpl, data);
+    }
+    return 0;
+}
+
+int rule_tpl_replica_delete(struct rule_tpl_replica *rep,
+            unsigned int id, TPL_FREE tpl_free)
+{
+    int ret = -1;
+    int i;
+
+    if (NULL == rep) {
+        return -1;
+    }
+
+    for (i = 0; i < rep->nr_nodes; i++) {
+        if (0 == rule_tpl_pool_delete(&rep->nodes[i].root, id, tpl_free,
+                                      rep->nodes[i].pool)) {
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+struct rb_root *rule_tpl_replica_local(struct rule_tpl_replica *rep)
+{
+    int cpu = sched_getcpu();
+    int node = 0;
+
+    if ((cpu >= 0) && (cpu < rep->nr_cpus)) {
+        node = rep->cpu_node[cpu];
+    }
+    return &rep->nodes[node].root;
+}
@@ -0,0 +1,80 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_REPLICA_H
+#define	___RB_REPLICA_H
+
+#include "rb_mempool.h"
+
+/*
+  replicated rule table
+  One copy of the tree per NUMA node, every copy allocated from a node
+  pool bound to its node. Only the online nodes get a copy, and a copy
+  is never left unbound on a multi node system. Writes are applied to
+  all the copies, lookups go to the copy of the node the calling cpu
+  belongs to.
+  As the plain rule tables, writers must be serialized by the caller and
+  must not run concurrently with the readers.
+ */
+struct rule_tpl_replica_node {
+    struct rb_root      root;
+    struct rb_mempool  *pool;
+    int                 node;       /* NUMA node id */
+} __attribute__((aligned(64)));
+
+struct rule_tpl_replica {
+    unsigned long                 size;       /* size of actual table */
+    int                           nr_nodes;
+    int                           nr_cpus;
+    int                          *cpu_node;   /* cpu to index of nodes */
+    struct rule_tpl_replica_node *nodes;
+};
+
+/*
+  replicated table create function
+  size   : the size of actual table, must be more than sizeof(struct rule_tpl)
+  nr_objs: nodes to reserve per replica
+  page   : page type of the node pools, RB_PAGE_4K/RB_PAGE_2M/RB_PAGE_1G
+ */
+extern struct rule_tpl_replica *rule_tpl_replica_alloc(unsigned long size,
+            unsigned long nr_objs, int page);
+extern void rule_tpl_replica_free(struct rule_tpl_replica *rep,
+            TPL_FREE tpl_free);
+
+/*
+  data is a whole actual table, the bytes after struct rule_tpl are
+  copied to every replica, the node and id part is ignored.
+  tpl_free of delete is called once for every replica.
+ */
+extern int rule_tpl_replica_create(struct rule_tpl_replica *rep,
+            unsigned int id, const void *data);
+extern int rule_tpl_replica_update(struct rule_tpl_replica *rep,
+            unsigned int id, const void *data);
+extern int rule_tpl_replica_delete(struct rule_tpl_replica *rep,
+            unsigned int id, TPL_FREE tpl_free);
+
+/*
+  the replica of the node the current cpu belongs to, threads pinned to
+  a cpu may cache the result.
+ */
+extern struct rb_root *rule_tpl_replica_local(struct rule_tpl_replica *rep);
+
+/*
+  replicated table search function, lookup in the local replica.
+ */
+static inline void *
+rule_tpl_replica_search(struct rule_tpl_replica *rep, unsigned int id)
+{
+    if (NULL == rep) {
+        return NULL;
+    }
+
+    return rule_tpl_search(rule_tpl_replica_local(rep), id);
+}
+
+#endif	/* ___RB_REPLICA_H */
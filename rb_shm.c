@@ -0,0 +1,552 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Red black tree in shared memory, ported from rbtree.c with offsets
+ * from the segment start in place of pointers.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rb_shm.h"
+
+#define RB_SHM_HDR_SIZE     ((sizeof(struct rb_shm_hdr) + 63) & ~63UL)
+
+/* the accessors expect a local "char *b", the segment base */
+#define N(x)            ((struct rb_shm_node *)(b + (x)))
+#define PC(x)           (N(x)->parent_color)
+#define L(x)            (N(x)->left)
+#define R(x)            (N(x)->right)
+#define P(x)            (PC(x) & ~3UL)
+#define COLOR(x)        (PC(x) & 1)
+#define IS_RED(x)       (!COLOR(x))
+#define IS_BLACK(x)     COLOR(x)
+#define SET_RED(x)      do { PC(x) &= ~1UL; } while (0)
+#define SET_BLACK(x)    do { PC(x) |= 1UL; } while (0)
+#define SET_PARENT(x, p) do { PC(x) = (PC(x) & 3UL) | (p); } while (0)
+#define SET_COLOR(x, c) do { PC(x) = (PC(x) & ~1UL) | (c); } while (0)
+
+static void shm_rotate_left(char *b, struct rb_shm_hdr *hdr, unsigned long node)
+{
+	unsigned long right = R(node);
+	unsigned long parent = P(node);
+
+	if ((R(node) = L(right)))
+		SET_PARENT(L(right), node);
+	L(right) = node;
+
+	SET_PARENT(right, parent);
+
+	if (parent)
+	{
+		if (node == L(parent))
+			L(parent) = right;
+		else
+			R(parent) = right;
+	}
+	else
+		hdr->root = right;
+	SET_PARENT(node, right);
+}
+
+static void shm_rotate_right(char *b, struct rb_shm_hdr *hdr, unsigned long node)
+{
+	unsigned long left = L(node);
+	unsigned long parent = P(node);
+
+	if ((L(node) = R(left)))
+		SET_PARENT(R(left), node);
+	R(left) = node;
+
+	SET_PARENT(left, parent);
+
+	if (parent)
+	{
+		if (node == R(parent))
+			R(parent) = left;
+		else
+			L(parent) = left;
+	}
+	else
+		hdr->root = left;
+	SET_PARENT(node, left);
+}
+
+static void shm_insert_color(char *b, struct rb_shm_hdr *hdr, unsigned long node)
+{
+	unsigned long parent, gparent, uncle, tmp;
+
+	while ((parent = P(node)) && IS_RED(parent))
+	{
+		gparent = P(parent);
+
+		if (parent == L(gparent))
+		{
+			uncle = R(gparent);
+			if (uncle && IS_RED(uncle))
+			{
+				SET_BLACK(uncle);
+				SET_BLACK(parent);
+				SET_RED(gparent);
+				node = gparent;
+				continue;
+			}
+
+			if (R(parent) == node)
+			{
+				shm_rotate_left(b, hdr, parent);
+				tmp = parent;
+				parent = node;
+				node = tmp;
+			}
+
+			SET_BLACK(parent);
+			SET_RED(gparent);
+			shm_rotate_right(b, hdr, gparent);
+		} else {
+			uncle = L(gparent);
+			if (uncle && IS_RED(uncle))
+			{
+				SET_BLACK(uncle);
+				SET_BLACK(parent);
+				SET_RED(gparent);
+				node = gparent;
+				continue;
+			}
+
+			if (L(parent) == node)
+			{
+				shm_rotate_right(b, hdr, parent);
+				tmp = parent;
+				parent = node;
+				node = tmp;
+			}
+
+			SET_BLACK(parent);
+			SET_RED(gparent);
+			shm_rotate_left(b, hdr, gparent);
+		}
+	}
+
+	SET_BLACK(hdr->root);
+}
+
+static void shm_erase_color(char *b, struct rb_shm_hdr *hdr,
+			    unsigned long node, unsigned long parent)
+{
+	unsigned long other;
+
+	while ((!node || IS_BLACK(node)) && node != hdr->root)
+	{
+		if (L(parent) == node)
+		{
+			other = R(parent);
+			if (IS_RED(other))
+			{
+				SET_BLACK(other);
+				SET_RED(parent);
+				shm_rotate_left(b, hdr, parent);
+				other = R(parent);
+			}
+			if ((!L(other) || IS_BLACK(L(other))) &&
+			    (!R(other) || IS_BLACK(R(other))))
+			{
+				SET_RED(other);
+				node = parent;
+				parent = P(node);
+			}
+			else
+			{
+				if (!R(other) || IS_BLACK(R(other)))
+				{
+					SET_BLACK(L(other));
+					SET_RED(other);
+					shm_rotate_right(b, hdr, other);
+					other = R(parent);
+				}
+				SET_COLOR(other, COLOR(parent));
+				SET_BLACK(parent);
+				SET_BLACK(R(other));
+				shm_rotate_left(b, hdr, parent);
+				node = hdr->root;
+				break;
+			}
+		}
+		else
+		{
+			other = L(parent);
+			if (IS_RED(other))
+			{
+				SET_BLACK(other);
+				SET_RED(parent);
+				shm_rotate_right(b, hdr, parent);
+				other = L(parent);
+			}
+			if ((!L(other) || IS_BLACK(L(other))) &&
+			    (!R(other) || IS_BLACK(R(other))))
+			{
+				SET_RED(other);
+				node = parent;
+				parent = P(node);
+			}
+			else
+			{
+				if (!L(other) || IS_BLACK(L(other)))
+				{
+					SET_BLACK(R(other));
+					SET_RED(other);
+					shm_rotate_left(b, hdr, other);
+					other = L(parent);
+				}
+				SET_COLOR(other, COLOR(parent));
+				SET_BLACK(parent);
+				SET_BLACK(L(other));
+				shm_rotate_right(b, hdr, parent);
+				node = hdr->root;
+				break;
+			}
+		}
+	}
+	if (node)
+		SET_BLACK(node);
+}
+
+static void shm_erase(char *b, struct rb_shm_hdr *hdr, unsigned long node)
+{
+	unsigned long child, parent;
+	unsigned long color;
+
+	if (!L(node))
+		child = R(node);
+	else if (!R(node))
+		child = L(node);
+	else
+	{
+		unsigned long old = node, left;
+
+		node = R(node);
+		while ((left = L(node)) != 0)
+			node = left;
+
+		if (P(old)) {
+			if (L(P(old)) == old)
+				L(P(old)) = node;
+			else
+				R(P(old)) = node;
+		} else
+			hdr->root = node;
+
+		child = R(node);
+		parent = P(node);
+		color = COLOR(node);
+
+		if (parent == old) {
+			parent = node;
+		} else {
+			if (child)
+				SET_PARENT(child, parent);
+			L(parent) = child;
+
+			R(node) = R(old);
+			SET_PARENT(R(old), node);
+		}
+
+		PC(node) = PC(old);
+		L(node) = L(old);
+		SET_PARENT(L(old), node);
+
+		goto color;
+	}
+
+	parent = P(node);
+	color = COLOR(node);
+
+	if (child)
+		SET_PARENT(child, parent);
+	if (parent)
+	{
+		if (L(parent) == node)
+			L(parent) = child;
+		else
+			R(parent) = child;
+	}
+	else
+		hdr->root = child;
+
+ color:
+	if (color == RB_BLACK)
+		shm_erase_color(b, hdr, child, parent);
+}
+
+/* shared allocator, released nodes are kept on a list in the segment */
+static unsigned long shm_alloc(struct rule_tpl_shm *shm)
+{
+    struct rb_shm_hdr *hdr = shm->hdr;
+    char *b = shm->base;
+    unsigned long off;
+
+    if (hdr->free_list) {
+        off = hdr->free_list;
+        hdr->free_list = L(off);
+        return off;
+    }
+    if (hdr->brk + shm->node_size > shm->size) {
+        return 0;
+    }
+    off = hdr->brk;
+    hdr->brk += shm->node_size;
+    return off;
+}
+
+static void shm_free(struct rule_tpl_shm *shm, unsigned long off)
+{
+    char *b = shm->base;
+
+    L(off) = shm->hdr->free_list;
+    shm->hdr->free_list = off;
+}
+
+static void shm_write_begin(struct rule_tpl_shm *shm)
+{
+    __atomic_store_n(&shm->hdr->gen, shm->hdr->gen + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void shm_write_end(struct rule_tpl_shm *shm)
+{
+    __atomic_store_n(&shm->hdr->gen, shm->hdr->gen + 1, __ATOMIC_RELEASE);
+}
+
+static void shm_copy(struct rule_tpl_shm *shm, unsigned long off,
+            const void *data)
+{
+    if (data && (shm->node_size > sizeof(struct rule_tpl_shm_node))) {
+        memcpy(shm->base + off + sizeof(struct rule_tpl_shm_node),
+               (const char *)data + sizeof(struct rule_tpl_shm_node),
+               shm->node_size - sizeof(struct rule_tpl_shm_node));
+    }
+}
+
+struct rule_tpl_shm *rule_tpl_shm_open(const char *name,
+            unsigned long size, unsigned long nr_objs, int flags)
+{
+    struct rule_tpl_shm *shm;
+    struct rb_shm_hdr *hdr;
+    struct stat st;
+    unsigned long seg_size = 0;
+    unsigned long node_size = 0;
+    void *base;
+    int fd;
+
+    if (NULL == name) {
+        return NULL;
+    }
+
+    if (flags & RB_SHM_CREATE) {
+        if ((size < sizeof(struct rule_tpl_shm_node)) || (0 == nr_objs)) {
+            return NULL;
+        }
+        node_size = (size + sizeof(long) - 1) & ~(sizeof(long) - 1);
+        seg_size = RB_SHM_HDR_SIZE + nr_objs * node_size;
+
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            return NULL;
+        }
+        if (ftruncate(fd, seg_size) != 0) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+        base = mmap(NULL, seg_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    }
+    else {
+        fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) {
+            return NULL;
+        }
+        if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)RB_SHM_HDR_SIZE)) {
+            close(fd);
+            return NULL;
+        }
+        seg_size = st.st_size;
+        base = mmap(NULL, seg_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        if (flags & RB_SHM_CREATE) {
+            shm_unlink(name);
+        }
+        return NULL;
+    }
+
+    hdr = (struct rb_shm_hdr *)base;
+    if (flags & RB_SHM_CREATE) {
+        memset(hdr, 0, sizeof(*hdr));
+        memcpy(hdr->magic, RB_SHM_MAGIC, sizeof(RB_SHM_MAGIC));
+        hdr->version = RB_SHM_VERSION;
+        hdr->seg_size = seg_size;
+        hdr->node_size = node_size;
+        hdr->brk = RB_SHM_HDR_SIZE;
+    }
+    else {
+        if ((memcmp(hdr->magic, RB_SHM_MAGIC, sizeof(RB_SHM_MAGIC)) != 0) ||
+            (hdr->version != RB_SHM_VERSION) ||
+            (hdr->seg_size != seg_size) ||
+            (hdr->node_size < sizeof(struct rule_tpl_shm_node)) ||
+            (hdr->node_size > seg_size - RB_SHM_HDR_SIZE)) {
+            munmap(base, seg_size);
+            return NULL;
+        }
+        node_size = hdr->node_size;
+    }
+
+    shm = (struct rule_tpl_shm *)malloc(sizeof(*shm));
+    if (NULL == shm) {
+        munmap(base, seg_size);
+        if (flags & RB_SHM_CREATE) {
+            shm_unlink(name);
+        }
+        return NULL;
+    }
+    shm->base = (char *)base;
+    shm->size = seg_size;
+    shm->node_size = node_size;
+    shm->writer = !!(flags & RB_SHM_CREATE);
+    shm->hdr = hdr;
+    return shm;
+}
+
+void rule_tpl_shm_close(struct rule_tpl_shm *shm)
+{
+    if (NULL == shm) {
+        return;
+    }
+
+    munmap(shm->base, shm->size);
+    free(shm);
+}
+
+int rule_tpl_shm_unlink(const char *name)
+{
+    return shm_unlink(name);
+}
+
+int rule_tpl_shm_create(struct rule_tpl_shm *shm, unsigned int id,
+            const void *data)
+{
+    struct rule_tpl_shm_node *tpl;
+    unsigned long *link;
+    unsigned long parent = 0;
+    unsigned long off;
+    char *b;
+
+    if ((NULL == shm) || !shm->writer) {
+        return -1;
+    }
+    b = shm->base;
+
+    /* Figure out where to put new node */
+    link = &shm->hdr->root;
+    while (*link)
+    {
+        struct rule_tpl_shm_node *cur = (struct rule_tpl_shm_node *)N(*link);
+        parent = *link;
+        if (cur->id < id) {
+            link = &L(*link);
+        }
+        else if (cur->id > id) {
+            link = &R(*link);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    off = shm_alloc(shm);
+    if (0 == off) {
+        return -1;
+    }
+
+    /* fill the node before it is reachable */
+    tpl = (struct rule_tpl_shm_node *)N(off);
+    memset(tpl, 0, shm->node_size);
+    tpl->id = id;
+    tpl->node.parent_color = parent;
+    shm_copy(shm, off, data);
+
+    shm_write_begin(shm);
+    *link = off;
+    shm_insert_color(b, shm->hdr, off);
+    shm->hdr->count++;
+    shm_write_end(shm);
+    return 0;
+}
+
+/* writer side lookup, no generation check needed */
+static unsigned long shm_find(struct rule_tpl_shm *shm, unsigned int id)
+{
+    char *b = shm->base;
+    unsigned long off = shm->hdr->root;
+
+    while (off) {
+        struct rule_tpl_shm_node *cur = (struct rule_tpl_shm_node *)N(off);
+        if (cur->id < id) {
+            off = L(off);
+        }
+        else if (cur->id > id) {
+            off = R(off);
+        }
+        else {
+            break;
+        }
+    }
+    return off;
+}
+
+int rule_tpl_shm_update(struct rule_tpl_shm *shm, unsigned int id,
+            const void *data)
+{
+    unsigned long off;
+
+    if ((NULL == shm) || !shm->writer) {
+        return -1;
+    }
+
+    off = shm_find(shm, id);
+    if (0 == off) {
+        return -1;
+    }
+
+    shm_write_begin(shm);
+    shm_copy(shm, off, data);
+    shm_write_end(shm);
+    return 0;
+}
+
+int rule_tpl_shm_delete(struct rule_tpl_shm *shm, unsigned int id)
+{
+    unsigned long off;
+
+    if ((NULL == shm) || !shm->writer) {
+        return -1;
+    }
+
+    off = shm_find(shm, id);
+    if (0 == off) {
+        return -1;
+    }
+
+    shm_write_begin(shm);
+    shm_erase(shm->base, shm->hdr, off);
+    shm_free(shm, off);
+    shm->hdr->count--;
+    shm_write_end(shm);
+    return 0;
+}
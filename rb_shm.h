@@ -0,0 +1,160 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_SHM_H
+#define	___RB_SHM_H
+
+#include "rbtree.h"
+
+/*
+  shared memory rule table
+  The table lives in a POSIX shared memory segment together with its
+  node allocator. Links are offsets from the start of the segment, 0 is
+  NULL, so every process may map the segment at any address.
+  One process (control plane) writes, any number of processes read.
+  Every change is published by the generation counter: it is odd while
+  the writer changes the tree, readers retry when it moved under them.
+ */
+#define RB_SHM_MAGIC        "RBSHMTB"
+#define RB_SHM_VERSION      1
+
+/* open flags */
+#define RB_SHM_CREATE       1   /* create the segment, writer side */
+
+/* tree height can not exceed 2 * log2(n + 1) */
+#define RB_SHM_MAX_DEPTH    128
+
+struct rb_shm_node {
+    unsigned long   parent_color;
+    unsigned long   right;
+    unsigned long   left;
+};
+
+struct rule_tpl_shm_node {
+    struct rb_shm_node  node;
+    unsigned int        id;
+};
+
+struct rb_shm_hdr {
+    char            magic[8];
+    unsigned int    version;
+    unsigned int    pad;
+    unsigned long   seg_size;
+    unsigned long   node_size;  /* size of actual table */
+    unsigned long   gen;        /* odd while writing */
+    unsigned long   root;       /* offset of the root node */
+    unsigned long   count;
+    unsigned long   brk;        /* allocator, first unused offset */
+    unsigned long   free_list;  /* allocator, released nodes */
+} __attribute__((aligned(64)));
+
+struct rule_tpl_shm {
+    char               *base;
+    unsigned long       size;       /* mapped length */
+    unsigned long       node_size;  /* checked copy of hdr->node_size */
+    int                 writer;
+    struct rb_shm_hdr  *hdr;
+};
+
+/*
+  shared memory table open function
+  name    : the POSIX shared memory name, such as "/rule_acl"
+  size    : the size of actual table, RB_SHM_CREATE only
+  nr_objs : the max number of nodes, RB_SHM_CREATE only
+  flags   : RB_SHM_CREATE for the writer, 0 for the readers
+ */
+extern struct rule_tpl_shm *rule_tpl_shm_open(const char *name,
+            unsigned long size, unsigned long nr_objs, int flags);
+extern void rule_tpl_shm_close(struct rule_tpl_shm *shm);
+extern int rule_tpl_shm_unlink(const char *name);
+
+/*
+  writer side, data is a whole actual table, the bytes after
+  struct rule_tpl_shm_node are copied, the node and id part is ignored.
+ */
+extern int rule_tpl_shm_create(struct rule_tpl_shm *shm, unsigned int id,
+            const void *data);
+extern int rule_tpl_shm_update(struct rule_tpl_shm *shm, unsigned int id,
+            const void *data);
+extern int rule_tpl_shm_delete(struct rule_tpl_shm *shm, unsigned int id);
+
+/* reader side generation check, as a seqlock */
+static inline unsigned long
+rule_tpl_shm_read_begin(const struct rule_tpl_shm *shm)
+{
+    unsigned long gen;
+
+    while ((gen = __atomic_load_n(&shm->hdr->gen, __ATOMIC_ACQUIRE)) & 1) {
+        asm volatile("pause" ::: "memory");
+    }
+    return gen;
+}
+
+static inline int
+rule_tpl_shm_read_retry(const struct rule_tpl_shm *shm, unsigned long gen)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->hdr->gen, __ATOMIC_RELAXED) != gen;
+}
+
+/*
+  offset of the node of id, 0 if not found. Must be called between
+  rule_tpl_shm_read_begin() and rule_tpl_shm_read_retry(), the links are
+  checked against the segment because the writer may move them.
+ */
+static inline unsigned long
+rule_tpl_shm_search_off(const struct rule_tpl_shm *shm, unsigned int id)
+{
+    const volatile struct rule_tpl_shm_node *cur;
+    unsigned long limit = shm->size - shm->node_size;
+    unsigned long off = *(volatile unsigned long *)&shm->hdr->root;
+    int depth = 0;
+
+    while (off && (off <= limit) && (depth++ < RB_SHM_MAX_DEPTH)) {
+        cur = (const volatile struct rule_tpl_shm_node *)(shm->base + off);
+        if (cur->id < id) {
+            off = cur->node.left;
+        }
+        else if (cur->id > id) {
+            off = cur->node.right;
+        }
+        else {
+            return off;
+        }
+    }
+    return 0;
+}
+
+/*
+  shared memory table search function, copy the actual table to out.
+  id : the id of actual table
+  out: buffer of node_size bytes, may be NULL to test the existence
+ */
+static inline int
+rule_tpl_shm_lookup(const struct rule_tpl_shm *shm, unsigned int id,
+                    void *out)
+{
+    unsigned long gen;
+    unsigned long off;
+
+    if (NULL == shm) {
+        return -1;
+    }
+
+    do {
+        gen = rule_tpl_shm_read_begin(shm);
+        off = rule_tpl_shm_search_off(shm, id);
+        if (off && out) {
+            memcpy(out, shm->base + off, shm->node_size);
+        }
+    } while (rule_tpl_shm_read_retry(shm, gen));
+
+    return off ? 0 : -1;
+}
+
+#endif	/* ___RB_SHM_H */
@@ -0,0 +1,709 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Multi threaded benchmark and stress test of the concurrent rule
+   tables. N readers and M writers run against one shared table for a
+   fixed time, then the table is checked for red black rules, id order,
+   parent links and node count.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "rbtree.h"
+#include "rb_fc.h"
+#include "rb_pipe.h"
+
+#define STRESS_MODE_RWLOCK  1   /* plain table under a pthread rwlock */
+#define STRESS_MODE_FC      2   /* flat combining, rb_fc.h */
+#define STRESS_MODE_PIPE    3   /* batched left-right pipeline, rb_pipe.h */
+
+#define STRESS_DIST_UNIFORM 1
+#define STRESS_DIST_ZIPF    2   /* skewed, theta 0.99 */
+#define STRESS_DIST_SEQ     3   /* every thread walks the ids in order */
+
+/* latency histogram, 8 sub buckets per power of 2 of ns */
+#define LAT_SUB_BITS        3
+#define LAT_BUCKETS         (64 << LAT_SUB_BITS)
+
+/* the payload must follow struct rule_tpl, not sit in its padding */
+struct stress_rule {
+    struct rule_tpl  tpl;
+    unsigned int     check;     /* STRESS_CHECK(id), set by the writers */
+};
+
+#define STRESS_CHECK(id)    ((id) ^ 0x5a5aa5a5)
+
+struct stress_thread {
+    pthread_t        thread;
+    int              idx;
+    int              writer;
+    int              cpu;       /* -1 if not pinned */
+    unsigned long    seed;
+    unsigned long    ops;
+    unsigned long    hits;
+    unsigned long    corrupt;   /* node of another id or bad payload */
+    long             net;       /* creates - deletes that succeeded */
+    unsigned long    lat[LAT_BUCKETS];
+    struct rule_tpl_fc_slot *slot;
+} __attribute__((aligned(64)));
+
+/* test params */
+static int stress_mode = STRESS_MODE_RWLOCK;
+static int stress_dist = STRESS_DIST_UNIFORM;
+static int readers_num = 2;
+static int writers_num = 1;
+static int duration = 3;            /* seconds */
+static unsigned int keys_num = 100000;
+static int pin_cpu = -1;            /* first cpu, -1 for no pinning */
+
+static char *progname;
+
+/* shared table */
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct rb_root table_root = RB_ROOT;
+static struct rule_tpl_fc *table_fc;
+static struct rule_tpl_pipe *table_pipe;
+
+static pthread_barrier_t start_barrier;
+static volatile int stop_flag;
+
+/* zipf generator, Gray et al. "Quickly generating billion-record
+   synthetic databases" */
+static double zipf_theta = 0.99;
+static double zipf_zetan;
+static double zipf_alpha;
+static double zipf_eta;
+
+static inline unsigned long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static inline unsigned long xorshift64(unsigned long *s)
+{
+    unsigned long x = *s;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *s = x;
+    return x;
+}
+
+static void zipf_init(unsigned int n)
+{
+    double zeta2 = 0;
+    unsigned int i;
+
+    zipf_zetan = 0;
+    for (i = 1; i <= n; i++) {
+        zipf_zetan += 1.0 / pow((double)i, zipf_theta);
+    }
+    for (i = 1; i <= 2; i++) {
+        zeta2 += 1.0 / pow((double)i, zipf_theta);
+    }
+    zipf_alpha = 1.0 / (1.0 - zipf_theta);
+    zipf_eta = (1.0 - pow(2.0 / n, 1.0 - zipf_theta)) /
+               (1.0 - zeta2 / zipf_zetan);
+}
+
+static inline unsigned int next_key(struct stress_thread *t)
+{
+    unsigned long r = xorshift64(&t->seed);
+    double u, uz;
+
+    switch (stress_dist) {
+    case STRESS_DIST_ZIPF:
+        u = (double)(r >> 11) / (double)(1UL << 53);
+        uz = u * zipf_zetan;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + pow(0.5, zipf_theta)) {
+            return 1;
+        }
+        return (unsigned int)(keys_num *
+               pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha)) % keys_num;
+    case STRESS_DIST_SEQ:
+        return (unsigned int)(t->ops % keys_num);
+    default:
+        return (unsigned int)(r % keys_num);
+    }
+}
+
+static inline void lat_record(struct stress_thread *t, unsigned long ns)
+{
+    unsigned int bits;
+    unsigned int idx;
+
+    if (ns < (1UL << LAT_SUB_BITS)) {
+        idx = (unsigned int)ns;
+    }
+    else {
+        bits = 63 - __builtin_clzl(ns);
+        idx = ((bits - LAT_SUB_BITS + 1) << LAT_SUB_BITS) |
+              (unsigned int)((ns >> (bits - LAT_SUB_BITS)) &
+                             ((1 << LAT_SUB_BITS) - 1));
+    }
+    t->lat[idx]++;
+}
+
+/* upper bound in ns of a histogram bucket */
+static unsigned long lat_bucket_ns(unsigned int idx)
+{
+    unsigned int shift;
+
+    if (idx < (1 << LAT_SUB_BITS)) {
+        return idx;
+    }
+    shift = (idx >> LAT_SUB_BITS) - 1;
+    return ((unsigned long)((1 << LAT_SUB_BITS) |
+            (idx & ((1 << LAT_SUB_BITS) - 1))) + 1) << shift;
+}
+
+static unsigned long lat_percentile(const unsigned long *lat,
+            unsigned long total, double pct)
+{
+    unsigned long want = (unsigned long)(total * pct / 100.0);
+    unsigned long seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        seen += lat[i];
+        if (seen > want) {
+            return lat_bucket_ns(i);
+        }
+    }
+    return 0;
+}
+
+static unsigned long lat_max(const unsigned long *lat)
+{
+    int i;
+
+    for (i = LAT_BUCKETS - 1; i >= 0; i--) {
+        if (lat[i]) {
+            return lat_bucket_ns(i);
+        }
+    }
+    return 0;
+}
+
+static void check_found(struct stress_thread *t, void *node, unsigned int id)
+{
+    struct stress_rule *rule = (struct stress_rule *)node;
+
+    if (NULL == rule) {
+        return;
+    }
+    t->hits++;
+    if ((rule->tpl.id != id) || (rule->check != STRESS_CHECK(id))) {
+        t->corrupt++;
+    }
+}
+
+static void stress_read(struct stress_thread *t, unsigned int id)
+{
+    struct rb_root *root;
+    void *node;
+
+    switch (stress_mode) {
+    case STRESS_MODE_RWLOCK:
+        pthread_rwlock_rdlock(&table_lock);
+        node = rule_tpl_search(&table_root, id);
+        check_found(t, node, id);
+        pthread_rwlock_unlock(&table_lock);
+        break;
+    case STRESS_MODE_FC:
+        /* a node returned by the combiner may be freed at once by a
+           writer, so it is never touched in fc mode */
+        if (rule_tpl_fc_search(table_fc, t->slot, id)) {
+            t->hits++;
+        }
+        break;
+    case STRESS_MODE_PIPE:
+        root = rule_tpl_pipe_read_lock(table_pipe);
+        node = rule_tpl_search(root, id);
+        check_found(t, node, id);
+        rule_tpl_pipe_read_unlock(table_pipe, root);
+        break;
+    }
+}
+
+static void stress_write(struct stress_thread *t, unsigned int id)
+{
+    struct stress_rule data;
+    struct stress_rule *rule;
+    int create = (int)(xorshift64(&t->seed) & 1);
+
+    switch (stress_mode) {
+    case STRESS_MODE_RWLOCK:
+        pthread_rwlock_wrlock(&table_lock);
+        if (create) {
+            rule = (struct stress_rule *)
+                rule_tpl_create(&table_root, id, sizeof(*rule));
+            if (rule) {
+                rule->check = STRESS_CHECK(id);
+                t->net++;
+            }
+        }
+        else if (rule_tpl_delete(&table_root, id, NULL) == 0) {
+            t->net--;
+        }
+        pthread_rwlock_unlock(&table_lock);
+        break;
+    case STRESS_MODE_FC:
+        if (create) {
+            if (rule_tpl_fc_create(table_fc, t->slot, id)) {
+                t->net++;
+            }
+        }
+        else if (rule_tpl_fc_delete(table_fc, t->slot, id) == 0) {
+            t->net--;
+        }
+        break;
+    case STRESS_MODE_PIPE:
+        if (create) {
+            data.check = STRESS_CHECK(id);
+            rule_tpl_pipe_set(table_pipe, id, &data);
+        }
+        else {
+            rule_tpl_pipe_del(table_pipe, id);
+        }
+        break;
+    }
+}
+
+static void *stress_thread_fn(void *arg)
+{
+    struct stress_thread *t = (struct stress_thread *)arg;
+    cpu_set_t set;
+    unsigned long start;
+    unsigned int id;
+
+    if (t->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(t->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            t->cpu = -1;
+        }
+    }
+    if (STRESS_MODE_FC == stress_mode) {
+        t->slot = rule_tpl_fc_slot_get(table_fc);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    while (!stop_flag) {
+        id = next_key(t);
+        start = now_ns();
+        if (t->writer) {
+            stress_write(t, id);
+        }
+        else {
+            stress_read(t, id);
+        }
+        lat_record(t, now_ns() - start);
+        t->ops++;
+    }
+
+    if (STRESS_MODE_FC == stress_mode) {
+        rule_tpl_fc_slot_put(table_fc, t->slot);
+    }
+    return NULL;
+}
+
+/* red black rules, descending id order and parent links, -1 if broken */
+static int check_subtree(struct rb_node *node, struct rb_node *parent,
+            unsigned long *count)
+{
+    struct rule_tpl *cur;
+    int lh, rh;
+
+    if (NULL == node) {
+        return 1;
+    }
+    if (rb_parent(node) != parent) {
+        printf("  bad parent link at node %p\n", (void *)node);
+        return -1;
+    }
+    if (rb_is_red(node) && parent && rb_is_red(parent)) {
+        printf("  red node %p has a red parent\n", (void *)node);
+        return -1;
+    }
+
+    cur = container_of(node, struct rule_tpl, node);
+    if ((node->rb_left &&
+         container_of(node->rb_left, struct rule_tpl, node)->id <= cur->id) ||
+        (node->rb_right &&
+         container_of(node->rb_right, struct rule_tpl, node)->id >= cur->id)) {
+        printf("  id order broken at id %u\n", cur->id);
+        return -1;
+    }
+
+    lh = check_subtree(node->rb_left, node, count);
+    rh = check_subtree(node->rb_right, node, count);
+    if ((lh < 0) || (rh < 0)) {
+        return -1;
+    }
+    if (lh != rh) {
+        printf("  black height %d/%d differs at id %u\n", lh, rh, cur->id);
+        return -1;
+    }
+    (*count)++;
+    return lh + rb_is_black(node);
+}
+
+/* the neighbours only are checked above, the walk catches the rest */
+static int check_table(struct rb_root *root, unsigned long *count)
+{
+    struct rb_node *node;
+    struct rb_node *next;
+
+    *count = 0;
+    if (root->rb_node && rb_is_red(root->rb_node)) {
+        printf("  red root\n");
+        return -1;
+    }
+    if (check_subtree(root->rb_node, NULL, count) < 0) {
+        return -1;
+    }
+    for (node = rb_first(root); node; node = next) {
+        next = rb_next(node);
+        if (next && (container_of(next, struct rule_tpl, node)->id >=
+                     container_of(node, struct rule_tpl, node)->id)) {
+            printf("  in order walk broken\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int table_init(void)
+{
+    struct stress_rule data;
+    struct stress_rule *rule;
+    int threads = readers_num + writers_num;
+    unsigned int id;
+
+    switch (stress_mode) {
+    case STRESS_MODE_FC:
+        table_fc = rule_tpl_fc_alloc(sizeof(struct stress_rule),
+                                     threads, NULL);
+        if (NULL == table_fc) {
+            return -1;
+        }
+        break;
+    case STRESS_MODE_PIPE:
+        table_pipe = rule_tpl_pipe_alloc(sizeof(struct stress_rule), NULL,
+                                         NULL);
+        if (NULL == table_pipe) {
+            return -1;
+        }
+        break;
+    }
+
+    /* half of the ids are in the table at start */
+    for (id = 0; id < keys_num; id += 2) {
+        switch (stress_mode) {
+        case STRESS_MODE_RWLOCK:
+            rule = (struct stress_rule *)
+                rule_tpl_create(&table_root, id, sizeof(*rule));
+            if (NULL == rule) {
+                return -1;
+            }
+            rule->check = STRESS_CHECK(id);
+            break;
+        case STRESS_MODE_FC:
+            /* no thread is running yet, fill the tree directly */
+            if (NULL == rule_tpl_create(&table_fc->root, id, sizeof(*rule))) {
+                return -1;
+            }
+            break;
+        case STRESS_MODE_PIPE:
+            data.check = STRESS_CHECK(id);
+            if (rule_tpl_pipe_set(table_pipe, id, &data) != 0) {
+                return -1;
+            }
+            break;
+        }
+    }
+    if (STRESS_MODE_PIPE == stress_mode) {
+        rule_tpl_pipe_flush(table_pipe);
+    }
+    return 0;
+}
+
+/* check the table after the run, -1 on any damage */
+static int table_verify(long net)
+{
+    unsigned long expect = (keys_num + 1) / 2 + net;
+    unsigned long count;
+    unsigned long count2;
+    struct rb_node *a;
+    struct rb_node *b;
+
+    switch (stress_mode) {
+    case STRESS_MODE_RWLOCK:
+        if (check_table(&table_root, &count) != 0) {
+            return -1;
+        }
+        break;
+    case STRESS_MODE_FC:
+        if (check_table(&table_fc->root, &count) != 0) {
+            return -1;
+        }
+        break;
+    default:
+        /* the outcome of a queued change is unknown, compare the copies */
+        rule_tpl_pipe_flush(table_pipe);
+        if ((check_table(&table_pipe->roots[0], &count) != 0) ||
+            (check_table(&table_pipe->roots[1], &count2) != 0)) {
+            return -1;
+        }
+        a = rb_first(&table_pipe->roots[0]);
+        b = rb_first(&table_pipe->roots[1]);
+        while (a && b) {
+            if ((container_of(a, struct rule_tpl, node)->id !=
+                 container_of(b, struct rule_tpl, node)->id) ||
+                (((struct stress_rule *)a)->check !=
+                 ((struct stress_rule *)b)->check) ||
+                (((struct stress_rule *)a)->check !=
+                 STRESS_CHECK(((struct stress_rule *)a)->tpl.id))) {
+                break;
+            }
+            a = rb_next(a);
+            b = rb_next(b);
+        }
+        if (a || b) {
+            printf("  the two copies differ or a payload is lost\n");
+            return -1;
+        }
+        printf("  nodes: %lu, copies identical\n", count);
+        return 0;
+    }
+
+    printf("  nodes: %lu, expected: %lu\n", count, expect);
+    return (count == expect) ? 0 : -1;
+}
+
+static void table_release(void)
+{
+    switch (stress_mode) {
+    case STRESS_MODE_RWLOCK:
+        rule_tpl_tree_clear(&table_root, NULL);
+        table_root = RB_ROOT;
+        break;
+    case STRESS_MODE_FC:
+        rule_tpl_fc_free(table_fc);
+        break;
+    case STRESS_MODE_PIPE:
+        rule_tpl_pipe_free(table_pipe);
+        break;
+    }
+}
+
+static void usage()
+{
+    printf(("\n  Usage:"
+       " %s runs readers and writers on one shared rule table.\n"
+       "  %s [-m mode] [-r readers] [-w writers] [-t seconds]\n"
+       "     [-k keys] [-d dist] [-c cpu]\n\n"
+       "  options:\n"
+       "  -m mode    : rwlock, fc or pipe, default rwlock\n"
+       "  -r readers : reader threads, default 2\n"
+       "  -w writers : writer threads, default 1\n"
+       "  -t seconds : run time, default 3\n"
+       "  -k keys    : id range, default 100000\n"
+       "  -d dist    : uniform, zipf or seq, default uniform\n"
+       "  -c cpu     : pin the threads to cpu, cpu+1, ..., default no pinning\n\n"
+       ), progname, progname);
+    exit(0);
+}
+
+static void parse_params(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:r:w:t:k:d:c:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "rwlock") == 0) {
+                stress_mode = STRESS_MODE_RWLOCK;
+            }
+            else if (strcmp(optarg, "fc") == 0) {
+                stress_mode = STRESS_MODE_FC;
+            }
+            else if (strcmp(optarg, "pipe") == 0) {
+                stress_mode = STRESS_MODE_PIPE;
+            }
+            else {
+                usage();
+            }
+            break;
+        case 'r':
+            readers_num = atoi(optarg);
+            break;
+        case 'w':
+            writers_num = atoi(optarg);
+            break;
+        case 't':
+            duration = atoi(optarg);
+            break;
+        case 'k':
+            keys_num = (unsigned int)atoi(optarg);
+            break;
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0) {
+                stress_dist = STRESS_DIST_UNIFORM;
+            }
+            else if (strcmp(optarg, "zipf") == 0) {
+                stress_dist = STRESS_DIST_ZIPF;
+            }
+            else if (strcmp(optarg, "seq") == 0) {
+                stress_dist = STRESS_DIST_SEQ;
+            }
+            else {
+                usage();
+            }
+            break;
+        case 'c':
+            pin_cpu = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if ((readers_num < 0) || (writers_num < 0) ||
+        (readers_num + writers_num == 0) || (duration <= 0) ||
+        (keys_num < 2)) {
+        usage();
+    }
+}
+
+static const char *mode_name[] = { "", "rwlock", "fc", "pipe" };
+static const char *dist_name[] = { "", "uniform", "zipf", "seq" };
+
+int main(int argc, char *argv[])
+{
+    struct stress_thread *threads;
+    unsigned long total_lat[LAT_BUCKETS];
+    unsigned long reads = 0, writes = 0, corrupt = 0;
+    unsigned long start, elapsed;
+    int nr_threads, ncpu, i, j, ret = 0;
+    long net = 0;
+    struct stress_thread *t;
+
+    progname = argv[0];
+    parse_params(argc, argv);
+    nr_threads = readers_num + writers_num;
+    ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("-----------------------------------------------------------\n");
+    printf("              Rule table concurrency stress                \n");
+    printf("      mode         :     %s\n", mode_name[stress_mode]);
+    printf("      readers      :     %d\n", readers_num);
+    printf("      writers      :     %d\n", writers_num);
+    printf("      seconds      :     %d\n", duration);
+    printf("      keys         :     %u (%s)\n", keys_num,
+           dist_name[stress_dist]);
+    printf("-----------------------------------------------------------\n");
+
+    if (STRESS_DIST_ZIPF == stress_dist) {
+        zipf_init(keys_num);
+    }
+    if (table_init() != 0) {
+        printf("Build test table failed, no enough memory\n");
+        return -1;
+    }
+
+    if (posix_memalign((void **)&threads, 64,
+                       nr_threads * sizeof(*threads)) != 0) {
+        printf("Alloc threads failed, no enough memory\n");
+        return -1;
+    }
+    memset(threads, 0, nr_threads * sizeof(*threads));
+
+    pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+    for (i = 0; i < nr_threads; i++) {
+        t = &threads[i];
+        t->idx = i;
+        t->writer = (i >= readers_num);
+        t->cpu = (pin_cpu >= 0) ? (pin_cpu + i) % ncpu : -1;
+        t->seed = 0x9e3779b97f4a7c15UL * (i + 1);
+        if (pthread_create(&t->thread, NULL, stress_thread_fn, t) != 0) {
+            printf("Create thread %d failed\n", i);
+            exit(-1);
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    start = now_ns();
+    sleep(duration);
+    stop_flag = 1;
+    for (i = 0; i < nr_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    elapsed = now_ns() - start;
+
+    printf(" thread  role  cpu       ops/s    p50(ns)    p99(ns)  p99.9(ns)"
+           "    max(ns)\n");
+    memset(total_lat, 0, sizeof(total_lat));
+    for (i = 0; i < nr_threads; i++) {
+        t = &threads[i];
+        printf(" %6d  %4s  %3d  %10.0f %10lu %10lu %10lu %10lu\n",
+               i, t->writer ? "W" : "R", t->cpu,
+               t->ops * 1e9 / elapsed,
+               lat_percentile(t->lat, t->ops, 50),
+               lat_percentile(t->lat, t->ops, 99),
+               lat_percentile(t->lat, t->ops, 99.9),
+               lat_max(t->lat));
+        if (t->writer) {
+            writes += t->ops;
+        }
+        else {
+            reads += t->ops;
+        }
+        corrupt += t->corrupt;
+        net += t->net;
+        for (j = 0; j < LAT_BUCKETS; j++) {
+            total_lat[j] += t->lat[j];
+        }
+    }
+    printf("-----------------------------------------------------------\n");
+    printf(" total: reads %.0f/s, writes %.0f/s, p99 %lu ns, p99.9 %lu ns\n",
+           reads * 1e9 / elapsed, writes * 1e9 / elapsed,
+           lat_percentile(total_lat, reads + writes, 99),
+           lat_percentile(total_lat, reads + writes, 99.9));
+
+    printf(" check:\n");
+    if (corrupt) {
+        printf("  %lu lookups returned a wrong node\n", corrupt);
+        ret = -1;
+    }
+    if (table_verify(net) != 0) {
+        ret = -1;
+    }
+    printf(" result: %s\n", ret ? "FAILED" : "OK");
+    printf("-----------------------------------------------------------\n");
+
+    table_release();
+    pthread_barrier_destroy(&start_barrier);
+    free(threads);
+    return ret;
+}
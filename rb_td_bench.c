@@ -0,0 +1,233 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Latency of the bottom up rule tables (rbtree.c) against the top
+   down compact ones (rb_topdown.h), on the same churn of ids: every
+   round deletes one id of the table and inserts one id out of it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "rbtree.h"
+#include "rb_topdown.h"
+
+/* node number, default 1M */
+static int nodes_num = 1000000;
+
+/* churn rounds, default 1M */
+static int rounds_num = 1000000;
+
+static char *progname;
+
+struct td_bench_lat {
+    unsigned long *insert;
+    unsigned long *del;
+};
+
+static inline unsigned long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int lat_cmp(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a;
+    unsigned long y = *(const unsigned long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void lat_report(const char *name, unsigned long *lat, int n)
+{
+    unsigned long sum = 0;
+    int i;
+
+    qsort(lat, n, sizeof(*lat), lat_cmp);
+    for (i = 0; i < n; i++) {
+        sum += lat[i];
+    }
+    printf(" %-16s %7lu %7lu %7lu %7lu %7lu %9lu\n", name,
+           sum / n, lat[n / 2], lat[(long)n * 90 / 100],
+           lat[(long)n * 99 / 100], lat[(long)n * 999 / 1000], lat[n - 1]);
+}
+
+/* ids[0, nodes_num) are in the table, the rest are out of it */
+static void shuffle_ids(unsigned int *ids, int n)
+{
+    unsigned int tmp;
+    int i, j;
+
+    for (i = n - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        tmp = ids[i];
+        ids[i] = ids[j];
+        ids[j] = tmp;
+    }
+}
+
+/* pick one id in and one id out of the table, and swap their roles */
+static inline void churn_pick(unsigned int *ids, unsigned int *in,
+            unsigned int *out)
+{
+    int i = rand() % nodes_num;
+    int o = nodes_num + rand() % nodes_num;
+    unsigned int tmp = ids[i];
+
+    *in = ids[i];
+    *out = ids[o];
+    ids[i] = ids[o];
+    ids[o] = tmp;
+}
+
+static void bench_bottom_up(unsigned int *ids, struct rule_tpl *nodes,
+            struct td_bench_lat *lat)
+{
+    struct rb_root root = RB_ROOT;
+    struct rule_tpl *tpl;
+    unsigned int in, out;
+    unsigned long t;
+    int i;
+
+    for (i = 0; i < nodes_num; i++) {
+        nodes[ids[i]].id = ids[i];
+        rule_tpl_insert(&root, &nodes[ids[i]]);
+    }
+
+    for (i = 0; i < rounds_num; i++) {
+        churn_pick(ids, &in, &out);
+
+        t = now_ns();
+        tpl = (struct rule_tpl *)rule_tpl_search(&root, in);
+        rb_erase(&tpl->node, &root);
+        lat->del[i] = now_ns() - t;
+
+        nodes[out].id = out;
+        t = now_ns();
+        rule_tpl_insert(&root, &nodes[out]);
+        lat->insert[i] = now_ns() - t;
+    }
+}
+
+static void bench_top_down(unsigned int *ids, struct rule_ttpl *nodes,
+            struct td_bench_lat *lat)
+{
+    struct rb_troot root = RB_TROOT;
+    unsigned int in, out;
+    unsigned long t;
+    int i;
+
+    for (i = 0; i < nodes_num; i++) {
+        nodes[ids[i]].id = ids[i];
+        rb_td_insert(&root, &nodes[ids[i]].node, &ids[i], rule_ttpl_compare);
+    }
+
+    for (i = 0; i < rounds_num; i++) {
+        churn_pick(ids, &in, &out);
+
+        t = now_ns();
+        rb_td_delete(&root, &in, rule_ttpl_compare);
+        lat->del[i] = now_ns() - t;
+
+        nodes[out].id = out;
+        t = now_ns();
+        rb_td_insert(&root, &nodes[out].node, &out, rule_ttpl_compare);
+        lat->insert[i] = now_ns() - t;
+    }
+}
+
+static void usage()
+{
+    printf(("\n  Usage:"
+            "\n    %s [-n nodes] [-r rounds]"
+            "\n      -n : node number, default 1000000"
+            "\n      -r : churn rounds, default 1000000\n\n"), progname);
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    struct td_bench_lat lat;
+    struct rule_tpl *bu_nodes;
+    struct rule_ttpl *td_nodes;
+    unsigned int *ids;
+    unsigned int *ids_copy;
+    int opt;
+    int i;
+
+    progname = argv[0];
+    while ((opt = getopt(argc, argv, "n:r:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            nodes_num = atoi(optarg);
+            break;
+        case 'r':
+            rounds_num = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if ((nodes_num <= 0) || (rounds_num <= 0)) {
+        usage();
+    }
+
+    ids = (unsigned int *)malloc(2 * nodes_num * sizeof(*ids));
+    ids_copy = (unsigned int *)malloc(2 * nodes_num * sizeof(*ids));
+    bu_nodes = (struct rule_tpl *)malloc(2 * nodes_num * sizeof(*bu_nodes));
+    td_nodes = (struct rule_ttpl *)malloc(2 * nodes_num * sizeof(*td_nodes));
+    lat.insert = (unsigned long *)malloc(rounds_num * sizeof(unsigned long));
+    lat.del = (unsigned long *)malloc(rounds_num * sizeof(unsigned long));
+    if ((NULL == ids) || (NULL == ids_copy) || (NULL == bu_nodes) ||
+        (NULL == td_nodes) || (NULL == lat.insert) || (NULL == lat.del)) {
+        printf("Build test data failed, no enough memory, nodes_num is %d\n",
+               nodes_num);
+        return -1;
+    }
+
+    for (i = 0; i < 2 * nodes_num; i++) {
+        ids[i] = i;
+    }
+    srand(2019);
+    shuffle_ids(ids, 2 * nodes_num);
+    memcpy(ids_copy, ids, 2 * nodes_num * sizeof(*ids));
+
+    printf("-----------------------------------------------------------\n");
+    printf("          bottom up vs top down rule table latency         \n");
+    printf("      nodes number :     %d \n", nodes_num);
+    printf("      churn rounds :     %d \n", rounds_num);
+    printf("      node size    :     %zu vs %zu bytes\n",
+           sizeof(struct rule_tpl), sizeof(struct rule_ttpl));
+    printf("-----------------------------------------------------------\n");
+    printf(" ns               %7s %7s %7s %7s %7s %9s\n",
+           "avg", "p50", "p90", "p99", "p99.9", "max");
+
+    /* same ids and same random picks for both */
+    srand(1);
+    bench_bottom_up(ids, bu_nodes, &lat);
+    lat_report("bottom up insert", lat.insert, rounds_num);
+    lat_report("bottom up delete", lat.del, rounds_num);
+
+    srand(1);
+    bench_top_down(ids_copy, td_nodes, &lat);
+    lat_report("top down insert", lat.insert, rounds_num);
+    lat_report("top down delete", lat.del, rounds_num);
+    printf("-----------------------------------------------------------\n");
+
+    free(lat.insert);
+    free(lat.del);
+    free(td_nodes);
+    free(bu_nodes);
+    free(ids_copy);
+    free(ids);
+    return 0;
+}
@@ -0,0 +1,373 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+/* Hierarchical timer wheel, with the far deadlines in an rbtree.
+ */
+#include "rb_timer.h"
+
+/* ticks covered by one slot of the top level */
+#define RB_WHEEL_TOP        (RB_WHEEL_SPAN >> RB_WHEEL_BITS)
+
+/* slot of the timers being expired, they are on a private list */
+#define RB_WHEEL_EXPIRING   ((unsigned short)-1)
+
+#define rb_wheel_index(t, l)    (((t) >> ((l) * RB_WHEEL_BITS)) & RB_WHEEL_MASK)
+
+static inline void rb_wheel_list_init(struct rb_node *head)
+{
+    head->rb_left = head;
+    head->rb_right = head;
+}
+
+static inline int rb_wheel_list_empty(const struct rb_node *head)
+{
+    return head->rb_right == head;
+}
+
+static inline void rb_wheel_list_add(struct rb_node *head, struct rb_node *node)
+{
+    node->rb_right = head;
+    node->rb_left = head->rb_left;
+    head->rb_left->rb_right = node;
+    head->rb_left = node;
+}
+
+static inline void rb_wheel_list_del(struct rb_node *node)
+{
+    node->rb_left->rb_right = node->rb_right;
+    node->rb_right->rb_left = node->rb_left;
+}
+
+/* move all the timers of head to the empty list to */
+static inline void rb_wheel_list_splice(struct rb_node *head, struct rb_node *to)
+{
+    if (rb_wheel_list_empty(head)) {
+        rb_wheel_list_init(to);
+        return;
+    }
+    to->rb_right = head->rb_right;
+    to->rb_left = head->rb_left;
+    to->rb_right->rb_left = to;
+    to->rb_left->rb_right = to;
+    rb_wheel_list_init(head);
+}
+
+/* wheel slot of a deadline, -1 if it is beyond the wheel */
+static int rb_wheel_slot(const struct rb_timer_base *base, unsigned long expires)
+{
+    unsigned long delta;
+    int l;
+
+    if (expires < base->jiffies) {
+        expires = base->jiffies;
+    }
+    delta = expires - base->jiffies;
+    for (l = 0; l < RB_WHEEL_LEVELS; l++) {
+        if (delta < (1UL << ((l + 1) * RB_WHEEL_BITS))) {
+            return l * RB_WHEEL_SIZE + rb_wheel_index(expires, l);
+        }
+    }
+    return -1;
+}
+
+/* same order as the deadlines, equal ones go right */
+static int rb_timer_compare(struct rb_node *node, void *key)
+{
+    unsigned long expires = ((struct rb_timer *)node)->expires;
+    unsigned long k = *(unsigned long *)key;
+
+    if (k < expires) {
+        return -1;
+    }
+    else if (k > expires) {
+        return 1;
+    }
+    return 0;
+}
+
+static void rb_timer_far_insert(struct rb_timer_base *base,
+            struct rb_timer *timer)
+{
+    struct rb_node **link = &base->far.rb_node;
+    struct rb_node *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        if (timer->expires < ((struct rb_timer *)parent)->expires) {
+            link = &parent->rb_left;
+        }
+        else {
+            link = &parent->rb_right;
+        }
+    }
+    rb_link_node(&timer->node, parent, link);
+    rb_insert_color(&timer->node, &base->far);
+}
+
+static void rb_timer_link(struct rb_timer_base *base, struct rb_timer *timer)
+{
+    int slot = rb_wheel_slot(base, timer->expires);
+
+    if (slot < 0) {
+        timer->where = RB_TIMER_TREE;
+        rb_timer_far_insert(base, timer);
+        base->far_count++;
+        return;
+    }
+
+    timer->where = RB_TIMER_WHEEL;
+    timer->slot = (unsigned short)slot;
+    rb_wheel_list_add(&base->slots[0][0] + slot, &timer->node);
+    base->bitmap[slot / RB_WHEEL_SIZE] |= 1ULL << (slot % RB_WHEEL_SIZE);
+    base->count++;
+}
+
+static void rb_timer_unlink(struct rb_timer_base *base, struct rb_timer *timer)
+{
+    struct rb_node *head;
+
+    if (RB_TIMER_TREE == timer->where) {
+        rb_erase(&timer->node, &base->far);
+        base->far_count--;
+    }
+    else {
+        rb_wheel_list_del(&timer->node);
+        if (timer->slot != RB_WHEEL_EXPIRING) {
+            head = &base->slots[0][0] + timer->slot;
+            if (rb_wheel_list_empty(head)) {
+                base->bitmap[timer->slot / RB_WHEEL_SIZE] &=
+                    ~(1ULL << (timer->slot % RB_WHEEL_SIZE));
+            }
+        }
+        base->count--;
+    }
+    timer->where = RB_TIMER_IDLE;
+}
+
+/* relink the timers of a slot of level l, return the slot index */
+static unsigned long rb_wheel_cascade(struct rb_timer_base *base, int l)
+{
+    unsigned long index = rb_wheel_index(base->jiffies, l);
+    struct rb_node list;
+    struct rb_node *node;
+
+    rb_wheel_list_splice(&base->slots[l][index], &list);
+    base->bitmap[l] &= ~(1ULL << index);
+    while (!rb_wheel_list_empty(&list)) {
+        node = list.rb_right;
+        rb_wheel_list_del(node);
+        base->count--;
+        rb_timer_link(base, (struct rb_timer *)node);
+    }
+    return index;
+}
+
+/*
+  pull the far timers that are now within the wheel, in one batch.
+  The detached range is turned into a list by right rotations, so the
+  timers are relinked in deadline order.
+ */
+static void rb_timer_pull_far(struct rb_timer_base *base)
+{
+    unsigned long hi = base->jiffies + RB_WHEEL_SPAN;
+    struct rb_root range = RB_ROOT;
+    struct rb_node *node, *left;
+
+    if (NULL == base->far.rb_node) {
+        return;
+    }
+    if (((struct rb_timer *)rb_first(&base->far))->expires >= hi) {
+        return;
+    }
+
+    rb_erase_range(&base->far, NULL, &hi, rb_timer_compare, NULL, &range);
+    node = range.rb_node;
+    while (node) {
+        left = node->rb_left;
+        if (left) {
+            node->rb_left = left->rb_right;
+            left->rb_right = node;
+            node = left;
+        }
+        else {
+            left = node->rb_right;
+            base->far_count--;
+            rb_timer_link(base, (struct rb_timer *)node);
+            node = left;
+        }
+    }
+}
+
+struct rb_timer_base *rb_timer_base_alloc(unsigned long now)
+{
+    struct rb_timer_base *base;
+    int l;
+    unsigned long i;
+
+    base = (struct rb_timer_base *)malloc(sizeof(*base));
+    if (NULL == base) {
+        return NULL;
+    }
+    memset(base, 0, sizeof(*base));
+
+    for (l = 0; l < RB_WHEEL_LEVELS; l++) {
+        for (i = 0; i < RB_WHEEL_SIZE; i++) {
+            rb_wheel_list_init(&base->slots[l][i]);
+        }
+    }
+    base->far = RB_ROOT;
+    base->jiffies = now;
+    return base;
+}
+
+void rb_timer_base_free(struct rb_timer_base *base)
+{
+    free(base);
+}
+
+int rb_timer_add(struct rb_timer_base *base, struct rb_timer *timer,
+            unsigned long expires)
+{
+    if ((NULL == base) || (NULL == timer)) {
+        return -1;
+    }
+    if (rb_timer_pending(timer)) {
+        return -1;
+    }
+
+    timer->expires = expires;
+    rb_timer_link(base, timer);
+    return 0;
+}
+
+int rb_timer_del(struct rb_timer_base *base, struct rb_timer *timer)
+{
+    if ((NULL == base) || (NULL == timer)) {
+        return -1;
+    }
+    if (!rb_timer_pending(timer)) {
+        return -1;
+    }
+
+    rb_timer_unlink(base, timer);
+    return 0;
+}
+
+int rb_timer_mod(struct rb_timer_base *base, struct rb_timer *timer,
+            unsigned long expires)
+{
+    struct rb_node *node;
+    int slot;
+
+    if ((NULL == base) || (NULL == timer)) {
+        return -1;
+    }
+
+    slot = rb_wheel_slot(base, expires);
+    if (RB_TIMER_WHEEL == timer->where) {
+        /* same slot, the timer is cascaded or expired at the same tick */
+        if (slot == timer->slot) {
+            timer->expires = expires;
+            return 1;
+        }
+    }
+    else if ((RB_TIMER_TREE == timer->where) && (slot < 0)) {
+        /* still far, and the order with the neighbours is kept */
+        node = rb_prev(&timer->node);
+        if ((NULL == node) || (((struct rb_timer *)node)->expires <= expires)) {
+            node = rb_next(&timer->node);
+            if ((NULL == node) ||
+                (expires <= ((struct rb_timer *)node)->expires)) {
+                timer->expires = expires;
+                return 1;
+            }
+        }
+    }
+
+    if (rb_timer_pending(timer)) {
+        rb_timer_unlink(base, timer);
+    }
+    timer->expires = expires;
+    rb_timer_link(base, timer);
+    return 0;
+}
+
+unsigned long rb_timer_expire(struct rb_timer_base *base, unsigned long now,
+            RB_TIMER_FN fn, void *arg)
+{
+    struct rb_node list;
+    struct rb_node *node;
+    struct rb_timer *timer;
+    unsigned long index, next, rest;
+    unsigned long expired = 0;
+    int l;
+
+    if (NULL == base) {
+        return 0;
+    }
+
+    while (base->jiffies <= now) {
+        index = base->jiffies & RB_WHEEL_MASK;
+        if (0 == index) {
+            /* a level is cascaded only when the one below wraps */
+            for (l = 1; l < RB_WHEEL_LEVELS; l++) {
+                if (rb_wheel_cascade(base, l) != 0) {
+                    break;
+                }
+            }
+            if (0 == (base->jiffies & (RB_WHEEL_TOP - 1))) {
+                rb_timer_pull_far(base);
+            }
+        }
+
+        /* expire from a private list, fn may link timers in this slot */
+        rb_wheel_list_splice(&base->slots[0][index], &list);
+        base->bitmap[0] &= ~(1ULL << index);
+        for (node = list.rb_right; node != &list; node = node->rb_right) {
+            ((struct rb_timer *)node)->slot = RB_WHEEL_EXPIRING;
+        }
+        base->jiffies++;
+
+        while (!rb_wheel_list_empty(&list)) {
+            timer = (struct rb_timer *)list.rb_right;
+            rb_timer_unlink(base, timer);
+            expired++;
+            if (fn) {
+                fn(timer, arg);
+            }
+        }
+
+        /* skip the empty ticks, but stop at the cascades */
+        if ((0 == base->count) && (0 == base->far_count)) {
+            next = now + 1;
+        }
+        else if (0 == base->count) {
+            next = (base->jiffies + RB_WHEEL_TOP - 1) & ~(RB_WHEEL_TOP - 1);
+        }
+        else {
+            index = base->jiffies & RB_WHEEL_MASK;
+            if (0 == index) {
+                continue;
+            }
+            rest = base->bitmap[0] >> index;
+            if (rest) {
+                next = base->jiffies + __builtin_ctzll(rest);
+            }
+            else {
+                next = (base->jiffies | RB_WHEEL_MASK) + 1;
+            }
+        }
+        if (next > now + 1) {
+            next = now + 1;
+        }
+        if (next > base->jiffies) {
+            base->jiffies = next;
+        }
+    }
+    return expired;
+}
@@ -0,0 +1,104 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_TIMER_H
+#define	___RB_TIMER_H
+
+#include <stdint.h>
+#include "rbtree.h"
+
+/*
+  timers on rb_node
+  Deadlines are in ticks, the unit is up to the caller. The timers due
+  within RB_WHEEL_SPAN ticks are kept in a hierarchical wheel: arm and
+  cancel are O(1), a slot of an upper level is cascaded down when the
+  time reaches it. The timers further away are kept in an rbtree
+  ordered by deadline, and are pulled into the wheel in one batch,
+  by rb_erase_range(), each time the top level turns a slot.
+  In the wheel the node is a list link: rb_left is the previous timer
+  and rb_right the next one in the slot.
+  The base is not thread safe.
+ */
+#define RB_WHEEL_BITS       6
+#define RB_WHEEL_SIZE       (1UL << RB_WHEEL_BITS)
+#define RB_WHEEL_MASK       (RB_WHEEL_SIZE - 1)
+#define RB_WHEEL_LEVELS     4
+#define RB_WHEEL_SPAN       (1UL << (RB_WHEEL_BITS * RB_WHEEL_LEVELS))
+
+#define RB_TIMER_IDLE       0
+#define RB_TIMER_WHEEL      1
+#define RB_TIMER_TREE       2
+
+struct rb_timer {
+    struct rb_node       node;
+    unsigned long        expires;
+    unsigned short       where;     /* RB_TIMER_IDLE/WHEEL/TREE */
+    unsigned short       slot;      /* level * RB_WHEEL_SIZE + index */
+};
+
+struct rb_timer_base {
+    unsigned long        jiffies;   /* next tick to run */
+    unsigned long        count;     /* timers in the wheel */
+    unsigned long        far_count; /* timers in the tree */
+    uint64_t             bitmap[RB_WHEEL_LEVELS];   /* non empty slots */
+    struct rb_node       slots[RB_WHEEL_LEVELS][RB_WHEEL_SIZE];
+    struct rb_root       far;
+};
+
+/* called for every expired timer, which is idle and may be armed again */
+typedef void (*RB_TIMER_FN)(struct rb_timer *timer, void *arg);
+
+/*
+  timer base create function
+  now: the current tick, the first tick to run
+ */
+extern struct rb_timer_base *rb_timer_base_alloc(unsigned long now);
+/* the pending timers are owned by the caller, they are left as is */
+extern void rb_timer_base_free(struct rb_timer_base *base);
+
+/*
+  timer arm function
+  expires: deadline, a past one fires at the next tick run.
+  return 0 if armed, -1 if the timer is already pending.
+ */
+extern int rb_timer_add(struct rb_timer_base *base, struct rb_timer *timer,
+            unsigned long expires);
+/* return 0 if cancelled, -1 if the timer was not pending */
+extern int rb_timer_del(struct rb_timer_base *base, struct rb_timer *timer);
+
+/*
+  timer rearm function, arms an idle timer too.
+  The timer is not moved if it stays in the same wheel slot, or in the
+  tree between the same neighbours.
+  return 1 if updated in place, 0 if moved.
+ */
+extern int rb_timer_mod(struct rb_timer_base *base, struct rb_timer *timer,
+            unsigned long expires);
+
+/*
+  timer expire function, runs the ticks up to now and calls fn on
+  every timer whose deadline is <= now, tick after tick. The empty
+  ticks are skipped with the slot bitmaps.
+  return the number of expired timers.
+ */
+extern unsigned long rb_timer_expire(struct rb_timer_base *base,
+            unsigned long now, RB_TIMER_FN fn, void *arg);
+
+static inline void rb_timer_init(struct rb_timer *timer)
+{
+    timer->where = RB_TIMER_IDLE;
+    timer->slot = 0;
+    timer->expires = 0;
+}
+
+static inline int rb_timer_pending(const struct rb_timer *timer)
+{
+    return timer->where != RB_TIMER_IDLE;
+}
+
+#endif	/* ___RB_TIMER_H */
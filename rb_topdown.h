@@ -0,0 +1,445 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RB_TOPDOWN_H
+#define	___RB_TOPDOWN_H
+
+#include "rbtree.h"
+
+/*
+  top down red black tree
+  Insert and delete rebalance on the way down, by color flips and
+  rotations around the current node, so one pass from the root is
+  enough and no node is visited twice. With no walk back up, the node
+  needs no parent pointer: a compact node is 16 bytes, the color is
+  kept in bit 0 of the left pointer.
+  The rules are the ones of rbtree.c, so the height bound is the same,
+  but the trees are not interchangeable with struct rb_node ones.
+  Without parent pointers, in order walks use struct rb_td_iter, which
+  keeps the path on a stack.
+ */
+struct rb_tnode
+{
+	unsigned long    rb_left_color;
+	struct rb_tnode *rb_right;
+} __attribute__((aligned(sizeof(long))));
+
+struct rb_troot
+{
+	struct rb_tnode *rb_node;
+};
+
+/* same as RB_COMPARE, <0 if key is on the left of node */
+typedef int (*RB_TCOMPARE)(struct rb_tnode *node, void *key);
+typedef void (*RB_TFREE)(struct rb_tnode *node);
+
+/* red black trees of 2^64 nodes are less than 128 high */
+#define RB_TD_DEPTH     128
+
+#define RB_TROOT        (struct rb_troot) { NULL, }
+
+#define rb_td_left(n)       ((struct rb_tnode *)((n)->rb_left_color & ~1UL))
+#define rb_td_is_red(n)     ((n) && !((n)->rb_left_color & 1))
+#define rb_td_set_red(n)    do { (n)->rb_left_color &= ~1UL; } while (0)
+#define rb_td_set_black(n)  do { (n)->rb_left_color |= 1UL; } while (0)
+
+static inline struct rb_tnode *rb_td_child(struct rb_tnode *n, int dir)
+{
+    return dir ? n->rb_right : rb_td_left(n);
+}
+
+static inline void rb_td_set_child(struct rb_tnode *n, int dir,
+                                   struct rb_tnode *c)
+{
+    if (dir) {
+        n->rb_right = c;
+    }
+    else {
+        n->rb_left_color = (n->rb_left_color & 1UL) | (unsigned long)c;
+    }
+}
+
+/* rotate root toward dir, the old child of !dir is returned */
+static inline struct rb_tnode *rb_td_single(struct rb_tnode *root, int dir)
+{
+    struct rb_tnode *save = rb_td_child(root, !dir);
+
+    rb_td_set_child(root, !dir, rb_td_child(save, dir));
+    rb_td_set_child(save, dir, root);
+    rb_td_set_red(root);
+    rb_td_set_black(save);
+    return save;
+}
+
+static inline struct rb_tnode *rb_td_double(struct rb_tnode *root, int dir)
+{
+    rb_td_set_child(root, !dir, rb_td_single(rb_td_child(root, !dir), !dir));
+    return rb_td_single(root, dir);
+}
+
+/*
+  top down insert function
+  root   : the tree
+  node   : the node to link, its key must be set
+  key    : the key of node, passed to compare
+  return 0 if inserted, -1 if the key already exists.
+ */
+static inline int
+rb_td_insert(struct rb_troot *root, struct rb_tnode *node, void *key,
+             RB_TCOMPARE compare)
+{
+    struct rb_tnode head;       /* false root, black */
+    struct rb_tnode *t, *g, *p, *q;
+    int dir = 0, last = 0, dir2, delta;
+    int ret = -1;
+
+    if ((NULL == root) || (NULL == node)) {
+        return -1;
+    }
+
+    /* new node is red */
+    node->rb_left_color = 0;
+    node->rb_right = NULL;
+
+    if (NULL == root->rb_node) {
+        rb_td_set_black(node);
+        root->rb_node = node;
+        return 0;
+    }
+
+    head.rb_left_color = 1;
+    head.rb_right = root->rb_node;
+    t = &head;
+    g = p = NULL;
+    q = head.rb_right;
+
+    for (;;) {
+        if (NULL == q) {
+            q = node;
+            rb_td_set_child(p, dir, q);
+            ret = 0;
+        }
+        else if (rb_td_is_red(rb_td_left(q)) && rb_td_is_red(q->rb_right)) {
+            /* split a 4 node on the way down */
+            rb_td_set_red(q);
+            rb_td_set_black(rb_td_left(q));
+            rb_td_set_black(q->rb_right);
+        }
+
+        /* two reds in a row, rotate at the grand parent */
+        if (rb_td_is_red(q) && rb_td_is_red(p)) {
+            dir2 = (t->rb_right == g);
+            if (q == rb_td_child(p, last)) {
+                rb_td_set_child(t, dir2, rb_td_single(g, !last));
+            }
+            else {
+                rb_td_set_child(t, dir2, rb_td_double(g, !last));
+            }
+        }
+
+        if (q == node) {
+            break;
+        }
+        delta = compare(q, key);
+        if (delta == 0) {
+            /* the flips above kept the tree valid */
+            break;
+        }
+
+        last = dir;
+        dir = (delta > 0);
+        if (g) {
+            t = g;
+        }
+        g = p;
+        p = q;
+        q = rb_td_child(q, dir);
+    }
+
+    root->rb_node = head.rb_right;
+    rb_td_set_black(root->rb_node);
+    return ret;
+}
+
+/*
+  top down delete function, unlink the node of key in one pass.
+  return the unlinked node, or NULL if not found.
+ */
+static inline struct rb_tnode *
+rb_td_delete(struct rb_troot *root, void *key, RB_TCOMPARE compare)
+{
+    struct rb_tnode head;       /* false root, black */
+    struct rb_tnode *g, *p, *q, *s, *r;
+    struct rb_tnode *f = NULL;  /* node of key */
+    struct rb_tnode *fp = NULL; /* parent of f */
+    int fdir = 0;
+    int dir = 1, last, dir2, delta;
+
+    if ((NULL == root) || (NULL == root->rb_node)) {
+        return NULL;
+    }
+
+    head.rb_left_color = 1;
+    head.rb_right = root->rb_node;
+    q = &head;
+    g = p = NULL;
+
+    /* go down to the in order predecessor of key, or key itself */
+    while (rb_td_child(q, dir)) {
+        last = dir;
+        g = p;
+        p = q;
+        q = rb_td_child(q, dir);
+        delta = (f == NULL) ? compare(q, key) : 1;
+        dir = (delta > 0);
+        if (delta == 0) {
+            f = q;
+            fp = p;
+            fdir = last;
+        }
+
+        /* push a red node down, q must end red or with a red child */
+        if (rb_td_is_red(q) || rb_td_is_red(rb_td_child(q, dir))) {
+            continue;
+        }
+        if (rb_td_is_red(rb_td_child(q, !dir))) {
+            r = rb_td_single(q, dir);
+            rb_td_set_child(p, last, r);
+            if (q == f) {
+                fp = r;
+                fdir = dir;
+            }
+            p = r;
+            continue;
+        }
+
+        s = rb_td_child(p, !last);
+        if (NULL == s) {
+            continue;
+        }
+        if (!rb_td_is_red(rb_td_left(s)) && !rb_td_is_red(s->rb_right)) {
+            /* color flip, merge into a 4 node */
+            rb_td_set_black(p);
+            rb_td_set_red(s);
+            rb_td_set_red(q);
+        }
+        else {
+            dir2 = (g->rb_right == p);
+            if (rb_td_is_red(rb_td_child(s, last))) {
+                r = rb_td_double(p, last);
+            }
+            else {
+                r = rb_td_single(p, last);
+            }
+            rb_td_set_child(g, dir2, r);
+            if (p == f) {
+                fp = r;
+                fdir = last;
+            }
+
+            rb_td_set_red(q);
+            rb_td_set_red(r);
+            rb_td_set_black(rb_td_left(r));
+            rb_td_set_black(r->rb_right);
+        }
+    }
+
+    if (f) {
+        /* unlink q, at most one child, then put it in the place of f */
+        rb_td_set_child(p, p->rb_right == q,
+                        rb_td_child(q, rb_td_left(q) == NULL));
+        if (q != f) {
+            q->rb_left_color = f->rb_left_color;
+            q->rb_right = f->rb_right;
+            rb_td_set_child(fp, fdir, q);
+        }
+    }
+
+    root->rb_node = head.rb_right;
+    if (root->rb_node) {
+        rb_td_set_black(root->rb_node);
+    }
+    return f;
+}
+
+static inline struct rb_tnode *
+rb_td_search(struct rb_troot *root, void *key, RB_TCOMPARE compare)
+{
+    struct rb_tnode *node;
+    int delta;
+
+    if (NULL == root) {
+        return NULL;
+    }
+
+    node = root->rb_node;
+    while (node != NULL) {
+        delta = compare(node, key);
+        if (delta < 0) {
+            node = rb_td_left(node);
+        }
+        else if (delta > 0) {
+            node = node->rb_right;
+        }
+        else {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/* in order walk, the path of the current node is on the stack */
+struct rb_td_iter {
+    struct rb_tnode *stack[RB_TD_DEPTH];
+    int              top;
+};
+
+static inline void rb_td_push_left(struct rb_td_iter *it, struct rb_tnode *n)
+{
+    while (n) {
+        it->stack[it->top++] = n;
+        n = rb_td_left(n);
+    }
+}
+
+static inline struct rb_tnode *
+rb_td_first(struct rb_td_iter *it, const struct rb_troot *root)
+{
+    it->top = 0;
+    rb_td_push_left(it, root->rb_node);
+    return it->top ? it->stack[it->top - 1] : NULL;
+}
+
+static inline struct rb_tnode *rb_td_next(struct rb_td_iter *it)
+{
+    struct rb_tnode *n;
+
+    if (0 == it->top) {
+        return NULL;
+    }
+    n = it->stack[--it->top];
+    rb_td_push_left(it, n->rb_right);
+    return it->top ? it->stack[it->top - 1] : NULL;
+}
+
+/* rule table templet on compact nodes, same order as struct rule_tpl */
+struct rule_ttpl {
+    struct rb_tnode      node;
+    unsigned int         id;
+};
+
+static inline int
+rule_ttpl_compare(struct rb_tnode *node, void *key)
+{
+    unsigned int id = ((struct rule_ttpl *)node)->id;
+    unsigned int k = *(unsigned int *)key;
+
+    if (id < k) {
+        return -1;
+    }
+    else if (id > k) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+  rule templet create function
+  root: the rb_troot of actual table to be insert.
+  id  : the id of actual table
+  size: the size of actual table, must be more than sizeof(struct rule_ttpl)
+ */
+static inline void *
+rule_ttpl_create(struct rb_troot *root, unsigned int id, unsigned long size)
+{
+    struct rule_ttpl *tpl;
+
+    if (NULL == root) {
+        return NULL;
+    }
+
+    tpl = (struct rule_ttpl *)malloc(size);
+    if (NULL == tpl) {
+        return NULL;
+    }
+    memset(tpl, 0, size);
+
+    tpl->id = id;
+    if (rb_td_insert(root, &tpl->node, &id, rule_ttpl_compare) != 0) {
+        free(tpl);
+        return NULL;
+    }
+    return (void *)tpl;
+}
+
+/*
+  rule templet delete function, release node memory.
+  root: the rb_troot of actual table to be remove.
+  id  : the id of actual table
+ */
+static inline int
+rule_ttpl_delete(struct rb_troot *root, unsigned int id, RB_TFREE tpl_free)
+{
+    struct rb_tnode *node;
+
+    node = rb_td_delete(root, &id, rule_ttpl_compare);
+    if (NULL == node) {
+        return -1;
+    }
+
+    if (tpl_free) {
+        tpl_free(node);
+    }
+    free((void *)node);
+    return 0;
+}
+
+static inline void *
+rule_ttpl_search(struct rb_troot *root, unsigned int id)
+{
+    return (void *)rb_td_search(root, &id, rule_ttpl_compare);
+}
+
+/*
+  rule templet tree clear function, without recursion nor parent
+  pointers: every node with a left child is rotated right until the
+  tree is a list, which is then released.
+ */
+static inline int
+rule_ttpl_tree_clear(struct rb_troot *root, RB_TFREE tpl_free)
+{
+    struct rb_tnode *node;
+    struct rb_tnode *left;
+
+    if (NULL == root) {
+        return -1;
+    }
+
+    node = root->rb_node;
+    while (node) {
+        left = rb_td_left(node);
+        if (left) {
+            node->rb_left_color = left->rb_right ?
+                                  (unsigned long)left->rb_right : 0;
+            left->rb_right = node;
+            node = left;
+        }
+        else {
+            left = node->rb_right;
+            if (tpl_free) {
+                tpl_free(node);
+            }
+            free((void *)node);
+            node = left;
+        }
+    }
+    root->rb_node = NULL;
+    return 0;
+}
+
+#endif	/* ___RB_TOPDOWN_H */
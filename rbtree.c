@@ -57,9 +57,14 @@ static void __rb_rotate_right(struct rb_node *node, struct rb_root *root)
 	rb_set_parent(node, left);
 }
 
-void rb_insert_color(struct rb_node *node, struct rb_root *root)
+/*
+ * Returns 1 when the fixup reached the root and recolored it, that is
+ * when the black height of the tree grew by one.
+ */
+static int __rb_insert_color(struct rb_node *node, struct rb_root *root)
 {
 	struct rb_node *parent, *gparent;
+	int grew;
 
 	while ((parent = rb_parent(node)) && rb_is_red(parent))
 	{
@@ -119,7 +124,14 @@ void rb_insert_color(struct rb_node *node, struct rb_root *root)
 		}
 	}
 
+	grew = !rb_parent(node) && rb_is_red(node);
 	rb_set_black(root->rb_node);
+	return grew;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+	__rb_insert_color(node, root);
 }
 
 static void __rb_erase_color(struct rb_node *node, struct rb_node *parent,
@@ -461,4 +473,255 @@ rb_delete(struct rb_root *root, void *key, RB_COMPARE compare)
     }
 
     return node;
-}
\ No newline at end of file
+}
+
+int rb_insert_batch(struct rb_root *root, struct rb_node **nodes,
+                void **keys, int nr, RB_COMPARE compare)
+{
+    struct rb_node *finger = NULL;
+    struct rb_node **link = NULL;
+    struct rb_node *cur;
+    int inserted = 0;
+    int delta;
+    int i;
+
+    if ((NULL == root) || (NULL == nodes) || (NULL == keys) || (nr < 0)) {
+        return -1;
+    }
+
+    for (i = 0; i < nr; i++) {
+        if (NULL == root->rb_node) {
+            rb_link_node(nodes[i], NULL, &root->rb_node);
+            rb_insert_color(nodes[i], root);
+            finger = nodes[i];
+            inserted++;
+            continue;
+        }
+
+        cur = finger ? rb_finger(finger, keys[i], compare) : root->rb_node;
+        for (;;) {
+            delta = compare(cur, keys[i]);
+            if (delta < 0)
+                link = &cur->rb_left;
+            else if (delta > 0)
+                link = &cur->rb_right;
+            else
+                break;
+            if (NULL == *link)
+                break;
+            cur = *link;
+        }
+
+        if (0 == delta) {
+            /* duplicated key, left out of the tree */
+            RB_CLEAR_NODE(nodes[i]);
+            continue;
+        }
+        rb_link_node(nodes[i], cur, link);
+        rb_insert_color(nodes[i], root);
+        finger = nodes[i];
+        inserted++;
+    }
+    return inserted;
+}
+
+/*
+ * Black height of a tree, the black nodes from the root to a leaf.
+ */
+static int __rb_black_height(struct rb_node *node)
+{
+    int height = 0;
+
+    for (; node != NULL; node = node->rb_left) {
+        if (rb_is_black(node))
+            height++;
+    }
+    return height;
+}
+
+/*
+ * Join the trees left and right with node in between, all of left is
+ * before node and all of right after it in tree order. lh and rh are
+ * the black heights, the black height of the result is returned in *h.
+ * The joined tree is rebalanced by rb_insert_color, node is linked as
+ * a red node where the black heights of both sides match.
+ */
+static struct rb_node *__rb_join(struct rb_node *left, int lh,
+                struct rb_node *node, struct rb_node *right, int rh, int *h)
+{
+    struct rb_root tree;
+    struct rb_node *cur, *parent = NULL;
+    int ch;
+
+    /* a red root may turn black, one more black level */
+    if (left && rb_is_red(left)) {
+        rb_set_black(left);
+        lh++;
+    }
+    if (right && rb_is_red(right)) {
+        rb_set_black(right);
+        rh++;
+    }
+
+    if (lh == rh) {
+        node->rb_left = left;
+        node->rb_right = right;
+        node->rb_parent_color = RB_BLACK;
+        if (left)
+            rb_set_parent(left, node);
+        if (right)
+            rb_set_parent(right, node);
+        *h = lh + 1;
+        return node;
+    }
+
+    if (lh > rh) {
+        /* down the right spine of left to a black node of height rh */
+        cur = left;
+        ch = lh;
+        while (!(ch == rh && (!cur || rb_is_black(cur)))) {
+            if (rb_is_black(cur))
+                ch--;
+            parent = cur;
+            cur = cur->rb_right;
+        }
+        node->rb_left = cur;
+        node->rb_right = right;
+        parent->rb_right = node;
+        tree.rb_node = left;
+        *h = lh;
+    } else {
+        cur = right;
+        ch = rh;
+        while (!(ch == lh && (!cur || rb_is_black(cur)))) {
+            if (rb_is_black(cur))
+                ch--;
+            parent = cur;
+            cur = cur->rb_left;
+        }
+        node->rb_left = left;
+        node->rb_right = cur;
+        parent->rb_left = node;
+        tree.rb_node = right;
+        *h = rh;
+    }
+
+    if (node->rb_left)
+        rb_set_parent(node->rb_left, node);
+    if (node->rb_right)
+        rb_set_parent(node->rb_right, node);
+    node->rb_parent_color = (unsigned long)parent;    /* red */
+    *h += __rb_insert_color(node, &tree);
+    return tree.rb_node;
+}
+
+/*
+ * Split the tree of black height h by key: the nodes before key go to
+ * *left, the others (key itself included) to *right.
+ */
+static void __rb_split(struct rb_node *node, int h, void *key,
+                RB_COMPARE compare, struct rb_node **left, int *lh,
+                struct rb_node **right, int *rh)
+{
+    struct rb_node *l, *r, *tl, *tr;
+    int ch, tlh, trh;
+
+    if (node == NULL) {
+        *left = *right = NULL;
+        *lh = *rh = 0;
+        return;
+    }
+
+    l = node->rb_left;
+    r = node->rb_right;
+    ch = h - (rb_is_black(node) ? 1 : 0);
+    if (l)
+        rb_set_parent(l, NULL);
+    if (r)
+        rb_set_parent(r, NULL);
+
+    if (compare(node, key) <= 0) {
+        /* key is before or at node, node and r go right */
+        __rb_split(l, ch, key, compare, &tl, &tlh, &tr, &trh);
+        *left = tl;
+        *lh = tlh;
+        *right = __rb_join(tr, trh, node, r, ch, rh);
+    } else {
+        __rb_split(r, ch, key, compare, &tl, &tlh, &tr, &trh);
+        *left = __rb_join(l, ch, node, tl, tlh, lh);
+        *right = tr;
+        *rh = trh;
+    }
+}
+
+int rb_erase_range(struct rb_root *root, void *lo, void *hi,
+            RB_COMPARE compare, RB_FREE free_cb, struct rb_root *detached)
+{
+    struct rb_node *before = NULL, *mid, *after = NULL, *node, *parent;
+    struct rb_root tree;
+    int h, bh, mh, ah;
+
+    if ((NULL == root) || (NULL == compare)) {
+        return -1;
+    }
+
+    h = __rb_black_height(root->rb_node);
+    mid = root->rb_node;
+    mh = h;
+    if (lo) {
+        __rb_split(mid, mh, lo, compare, &before, &bh, &mid, &mh);
+    }
+    if (hi) {
+        __rb_split(mid, mh, hi, compare, &mid, &mh, &after, &ah);
+    }
+
+    /* join what is left, the first node after the range is the middle */
+    if (after == NULL) {
+        root->rb_node = before;
+    } else if (before == NULL) {
+        root->rb_node = after;
+    } else {
+        tree.rb_node = after;
+        node = rb_first(&tree);
+        rb_erase(node, &tree);
+        ah = __rb_black_height(tree.rb_node);
+        root->rb_node = __rb_join(before, bh, node, tree.rb_node, ah, &h);
+    }
+    if (root->rb_node) {
+        rb_set_parent(root->rb_node, NULL);
+        rb_set_black(root->rb_node);
+    }
+    if (mid) {
+        rb_set_parent(mid, NULL);
+        rb_set_black(mid);
+    }
+
+    if (free_cb == NULL) {
+        if (detached)
+            detached->rb_node = mid;
+        return 0;
+    }
+
+    /* release the range without recursion, leaves first */
+    node = mid;
+    while (node) {
+        if (node->rb_left) {
+            node = node->rb_left;
+        } else if (node->rb_right) {
+            node = node->rb_right;
+        } else {
+            parent = rb_parent(node);
+            if (parent) {
+                if (parent->rb_left == node)
+                    parent->rb_left = NULL;
+                else
+                    parent->rb_right = NULL;
+            }
+            free_cb(node);
+            node = parent;
+        }
+    }
+    if (detached)
+        detached->rb_node = NULL;
+    return 0;
+}
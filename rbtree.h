@@ -13,6 +13,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct rb_node
 {
 	unsigned long  rb_parent_color;
@@ -29,6 +33,7 @@ struct rb_root
 };
 
 typedef int (*RB_COMPARE)(struct rb_node *node, void * key);
+typedef void (*RB_FREE)(struct rb_node *node);
 
 #define rb_parent(r)   ((struct rb_node *)((r)->rb_parent_color & ~3))
 #define rb_color(r)   ((r)->rb_parent_color & 1)
@@ -52,7 +57,7 @@ static inline void rb_set_color(struct rb_node *rb, int color)
 
 #ifndef container_of
 #define container_of(ptr, type, member) ({\
-        const typeof( ((type *)0)->member ) *__mptr = (ptr);\
+        const __typeof__( ((type *)0)->member ) *__mptr = (ptr);\
         (type *)( (char *)__mptr - offsetof(type,member) );})
 #endif
 
@@ -82,7 +87,7 @@ extern struct rb_node *rb_last(const struct rb_root *);
 
 /* Fast replacement of a single node without remove/rebalance/add/rebalance */
 extern void rb_replace_node(struct rb_node *victim,
-			    struct rb_node *new, struct rb_root *root);
+			    struct rb_node *new_node, struct rb_root *root);
 extern struct rb_node *rb_delete(struct rb_root *root,
                      void *key, RB_COMPARE compare);
 extern struct rb_node *rb_search(struct rb_root *root,
@@ -90,6 +95,64 @@ extern struct rb_node *rb_search(struct rb_root *root,
 extern int rb_insert(struct rb_root *root, struct rb_node *node,
             void *key, RB_COMPARE compare);
 
+/*
+  Insert nr nodes, keys[i] is the key of nodes[i]. Every search starts
+  from the node inserted last and climbs by rb_parent only as far as
+  needed, so a batch sorted in tree order costs O(k log(n/k)) instead
+  of O(k log n). Any order is correct, sorted is fast. A node of a key
+  already in the tree is left out, with RB_EMPTY_NODE() true.
+  return the number of nodes inserted, or -1 on bad params.
+ */
+extern int rb_insert_batch(struct rb_root *root, struct rb_node **nodes,
+            void **keys, int nr, RB_COMPARE compare);
+
+/*
+  Remove all the nodes in [lo, hi) of tree order in O(log n + k), by
+  splitting the tree at lo and hi and joining the two remaining parts.
+  NULL lo or hi is unbounded. The removed nodes are released by free_cb
+  one by one, or, with free_cb NULL, handed back in detached as a valid
+  tree to be released later.
+ */
+extern int rb_erase_range(struct rb_root *root, void *lo, void *hi,
+            RB_COMPARE compare, RB_FREE free_cb, struct rb_root *detached);
+
+/*
+  Finger search, climb from finger only as far as the subtree that
+  must hold key, and return the node to descend from, or the node of
+  key. When node is left child of parent, parent bounds the subtree on
+  the right, and the other way round, so one compare per level is
+  enough. Inline, so a constant compare is inlined too.
+ */
+static inline struct rb_node *
+rb_finger(struct rb_node *finger, void *key, RB_COMPARE compare)
+{
+    struct rb_node *node = finger;
+    struct rb_node *parent;
+    int after;
+    int delta;
+
+    delta = compare(finger, key);
+    if (0 == delta) {
+        return finger;
+    }
+    after = (delta > 0);
+
+    while ((parent = rb_parent(node)) != NULL) {
+        if (after ? (parent->rb_left == node) : (parent->rb_right == node)) {
+            /* parent bounds the subtree of node on the side of key */
+            delta = compare(parent, key);
+            if (0 == delta) {
+                return parent;
+            }
+            if ((delta > 0) != after) {
+                break;
+            }
+        }
+        node = parent;
+    }
+    return node;
+}
+
 static inline void rb_link_node(struct rb_node * node,
 				struct rb_node * parent, struct rb_node ** rb_link)
 {
@@ -115,6 +178,11 @@ struct rule_tpl {
 };
 
 typedef void (*TPL_FREE)(struct rb_node *);
+/*
+  called on dst, a byte copy of src, to make dst own copies of what the
+  payload of src owns. On failure it must leave dst owning nothing.
+ */
+typedef void (*TPL_COPY)(struct rb_node *dst, const struct rb_node *src);
 
 /*
   rule templet create function
@@ -126,24 +194,24 @@ static inline void *
 rule_tpl_create(struct rb_root *root, unsigned int id, unsigned long size)
 {
     struct rule_tpl *tpl;
-    struct rb_node **new;
+    struct rb_node **link;
     struct rb_node *parent = NULL;
 
     if (NULL == root) {
         return NULL;
     }
 
-    new = &(root->rb_node);
+    link = &(root->rb_node);
     /* Figure out where to put new node */
-    while (*new)
+    while (*link)
     {
-        struct rule_tpl *cur = container_of(*new, struct rule_tpl, node);
-        parent = *new;
+        struct rule_tpl *cur = container_of(*link, struct rule_tpl, node);
+        parent = *link;
         if (cur->id < id) {
-            new = &((*new)->rb_left);
+            link = &((*link)->rb_left);
         }
         else if (cur->id > id) {
-            new = &((*new)->rb_right);
+            link = &((*link)->rb_right);
         }
         else {
             return NULL;
@@ -158,11 +226,176 @@ rule_tpl_create(struct rb_root *root, unsigned int id, unsigned long size)
 
     tpl->id = id;
     /* Add new node and rebalance tree. */
-    rb_link_node(&tpl->node, parent, new);
+    rb_link_node(&tpl->node, parent, link);
     rb_insert_color(&tpl->node, root);
     return (void *)tpl;
 }
 
+/*
+  rule templet insert function, link a node allocated by the caller.
+  root: the rb_root of actual table to be insert.
+  tpl : the actual table node, tpl->id must be set.
+  return 0 if inserted, -1 if the id already exists.
+ */
+static inline int
+rule_tpl_insert(struct rb_root *root, struct rule_tpl *tpl)
+{
+    struct rb_node **link;
+    struct rb_node *parent = NULL;
+
+    if ((NULL == root) || (NULL == tpl)) {
+        return -1;
+    }
+
+    link = &(root->rb_node);
+    while (*link)
+    {
+        struct rule_tpl *cur = container_of(*link, struct rule_tpl, node);
+        parent = *link;
+        if (cur->id < tpl->id) {
+            link = &((*link)->rb_left);
+        }
+        else if (cur->id > tpl->id) {
+            link = &((*link)->rb_right);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    rb_link_node(&tpl->node, parent, link);
+    rb_insert_color(&tpl->node, root);
+    return 0;
+}
+
+/* compare function of rule_tpl tables, key is unsigned int *id */
+static inline int
+rule_tpl_compare(struct rb_node *node, void *key)
+{
+    struct rule_tpl *cur = container_of(node, struct rule_tpl, node);
+    unsigned int id = *(unsigned int *)key;
+
+    if (cur->id < id) {
+        return -1;
+    }
+    else if (cur->id > id) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+  rule templet finger insert function, link a node allocated by the
+  caller, searching from finger, the node linked last, instead of the
+  root. See rb_insert_batch().
+  root  : the rb_root of actual table to be insert.
+  finger: a node of the table, or NULL to search from the root
+  tpl   : the actual table node, tpl->id must be set.
+  return 0 if inserted, -1 if the id already exists.
+ */
+static inline int
+rule_tpl_finger_insert(struct rb_root *root, struct rule_tpl *finger,
+                       struct rule_tpl *tpl)
+{
+    struct rb_node **link;
+    struct rb_node *cur;
+    struct rule_tpl *pt;
+
+    if ((NULL == root) || (NULL == tpl)) {
+        return -1;
+    }
+    if ((NULL == finger) || (NULL == root->rb_node)) {
+        return rule_tpl_insert(root, tpl);
+    }
+
+    cur = rb_finger(&finger->node, &tpl->id, rule_tpl_compare);
+    for (;;) {
+        pt = container_of(cur, struct rule_tpl, node);
+        if (pt->id < tpl->id) {
+            link = &cur->rb_left;
+        }
+        else if (pt->id > tpl->id) {
+            link = &cur->rb_right;
+        }
+        else {
+            return -1;
+        }
+        if (NULL == *link) {
+            break;
+        }
+        cur = *link;
+    }
+
+    rb_link_node(&tpl->node, cur, link);
+    rb_insert_color(&tpl->node, root);
+    return 0;
+}
+
+static inline int rule_tpl_id_order(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+
+    return (x < y) - (x > y);
+}
+
+/*
+  rule templet batch create function
+  ids are sorted in place in tree order first, if they are not yet, and
+  every node is linked from the one created before it.
+  root: the rb_root of actual table to be insert.
+  ids : the ids of actual tables, nr of them
+  size: the size of actual table, must be more than sizeof(struct rule_tpl)
+  tpls: if not NULL, takes the node of ids[i], NULL for an existing id
+        or an id not reached
+  return the number of nodes created, or -1 on bad params or no
+  memory. On no memory the nodes created before stay in the table,
+  tpls tells which ones.
+ */
+static inline int
+rule_tpl_create_batch(struct rb_root *root, unsigned int *ids, int nr,
+                      unsigned long size, void **tpls)
+{
+    struct rule_tpl *finger = NULL;
+    struct rule_tpl *tpl;
+    int created = 0;
+    int i;
+
+    if ((NULL == root) || (NULL == ids) || (nr < 0) ||
+        (size < sizeof(struct rule_tpl))) {
+        return -1;
+    }
+
+    if (tpls) {
+        memset(tpls, 0, nr * sizeof(*tpls));
+    }
+    for (i = 1; i < nr; i++) {
+        if (ids[i - 1] < ids[i]) {
+            qsort(ids, nr, sizeof(*ids), rule_tpl_id_order);
+            break;
+        }
+    }
+
+    for (i = 0; i < nr; i++) {
+        tpl = (struct rule_tpl *)malloc(size);
+        if (NULL == tpl) {
+            return -1;
+        }
+        memset(tpl, 0, size);
+        tpl->id = ids[i];
+        if (rule_tpl_finger_insert(root, finger, tpl) != 0) {
+            free(tpl);
+            continue;
+        }
+        if (tpls) {
+            tpls[i] = tpl;
+        }
+        finger = tpl;
+        created++;
+    }
+    return created;
+}
+
 /*
   rule templet delete function, release node memory.
   root: the rb_root of actual table to be remove.
@@ -203,8 +436,9 @@ rule_tpl_delete(struct rb_root *root, unsigned int id, TPL_FREE tpl_free)
 }
 
 /*
-  rule templet node clear recursive function,
-  it will delete the sub tree of the node,
+  rule templet node clear function,
+  it will delete the sub tree of the node without recursion, walking
+  down to a leaf and back up by the parent pointers,
   if node is point to root, it will delete the whole tree
   node: the any rb_node of rb_tree
   tpl_free: the free function, if there are some resources to release
@@ -212,13 +446,33 @@ rule_tpl_delete(struct rb_root *root, unsigned int id, TPL_FREE tpl_free)
 static inline void
 rule_tpl_node_clear(struct rb_node *node, TPL_FREE tpl_free)
 {
-    if (node) {
-        rule_tpl_node_clear(node->rb_left, tpl_free);
-        rule_tpl_node_clear(node->rb_right, tpl_free);
-        if (tpl_free) {
-            tpl_free(node);
+    struct rb_node *top = node;
+    struct rb_node *parent;
+
+    while (node) {
+        if (node->rb_left) {
+            node = node->rb_left;
+        }
+        else if (node->rb_right) {
+            node = node->rb_right;
+        }
+        else {
+            /* leaf, detach it from the parent inside the sub tree */
+            parent = (node == top) ? NULL : rb_parent(node);
+            if (parent) {
+                if (parent->rb_left == node) {
+                    parent->rb_left = NULL;
+                }
+                else {
+                    parent->rb_right = NULL;
+                }
+            }
+            if (tpl_free) {
+                tpl_free(node);
+            }
+            free((void *)node);
+            node = parent;
         }
-        free((void *)node);
     }
 }
 
@@ -239,6 +493,80 @@ rule_tpl_tree_clear(struct rb_root *root, TPL_FREE tpl_free)
     return 0;
 }
 
+/*
+  rule templet tree detach function,
+  move the whole tree to detached and leave root empty, so the table
+  can be reused at once and the old nodes released by
+  rule_tpl_clear_step() later.
+  root: the rb_root of rb_tree
+  detached: the rb_root to take the nodes
+ */
+static inline int
+rule_tpl_tree_detach(struct rb_root *root, struct rb_root *detached)
+{
+    if ((NULL == root) || (NULL == detached)) {
+        return -1;
+    }
+
+    detached->rb_node = root->rb_node;
+    root->rb_node = NULL;
+    return 0;
+}
+
+/*
+  rule templet incremental clear function,
+  release at most budget nodes of a detached tree, so that a big table
+  is released in slices of bounded latency. The tree is not balanced
+  any more after the first call, only more calls are allowed on it.
+  root: the detached rb_root
+  budget: the max number of nodes to release
+  tpl_free: the free function, if there are some resources to release
+  return the number of nodes released, root->rb_node is NULL when done
+ */
+static inline unsigned long
+rule_tpl_clear_step(struct rb_root *root, unsigned long budget,
+                    TPL_FREE tpl_free)
+{
+    struct rb_node *node;
+    struct rb_node *parent;
+    unsigned long freed = 0;
+
+    if (NULL == root) {
+        return 0;
+    }
+
+    node = root->rb_node;
+    while (node && (freed < budget)) {
+        if (node->rb_left) {
+            node = node->rb_left;
+        }
+        else if (node->rb_right) {
+            node = node->rb_right;
+        }
+        else {
+            parent = rb_parent(node);
+            if (parent) {
+                if (parent->rb_left == node) {
+                    parent->rb_left = NULL;
+                }
+                else {
+                    parent->rb_right = NULL;
+                }
+            }
+            else {
+                root->rb_node = NULL;
+            }
+            if (tpl_free) {
+                tpl_free(node);
+            }
+            free((void *)node);
+            freed++;
+            node = parent;
+        }
+    }
+    return freed;
+}
+
 /*
   rule templet search function
   root: the rb_root of actual table to be insert.
@@ -267,4 +595,75 @@ rule_tpl_search(struct rb_root *root, unsigned int id) {
     return NULL;
 }
 
+/*
+  rule templet finger search function, same as rule_tpl_search, but
+  starts from finger, a node of the table close to id, so sorted
+  lookups cost O(log d) for a distance d instead of O(log n).
+  finger: a node of the table, or NULL to search from the root
+ */
+static inline void *
+rule_tpl_finger_search(struct rb_root *root, struct rule_tpl *finger,
+                       unsigned int id)
+{
+    struct rb_node *node;
+    struct rule_tpl *cur;
+
+    if ((NULL == root) || (NULL == finger)) {
+        return rule_tpl_search(root, id);
+    }
+
+    node = rb_finger(&finger->node, &id, rule_tpl_compare);
+    while (node != NULL) {
+        cur = container_of(node, struct rule_tpl, node);
+        if (cur->id < id) {
+            node = node->rb_left;
+        }
+        else if (cur->id > id) {
+            node = node->rb_right;
+        }
+        else {
+            return (void *)node;
+        }
+    }
+    return NULL;
+}
+
+/*
+  rule templet range delete function, release the ids in [lo, hi).
+  root: the rb_root of actual table to be remove.
+  lo  : the first id to remove
+  hi  : the first id to keep after lo
+  tpl_free: the free function, if there are some resources to release
+ */
+static inline int
+rule_tpl_erase_range(struct rb_root *root, unsigned int lo, unsigned int hi,
+                     TPL_FREE tpl_free)
+{
+    struct rb_root detached = RB_ROOT;
+    unsigned int first;
+    unsigned int last;
+
+    if (NULL == root) {
+        return -1;
+    }
+    if (lo >= hi) {
+        return 0;
+    }
+
+    /* bigger ids come first in tree order: [hi - 1, lo - 1) */
+    first = hi - 1;
+    last = lo - 1;
+    if (rb_erase_range(root, &first, lo ? &last : NULL, rule_tpl_compare,
+                       NULL, &detached) != 0) {
+        return -1;
+    }
+
+    rule_tpl_node_clear(detached.rb_node, tpl_free);
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif	/* _LINUX_RBTREE_H */
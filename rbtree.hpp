@@ -0,0 +1,864 @@
+/***************************************************************
+  Copyright (c) 2019 ShenZhen Panath Technology, Inc.
+
+  The right to copy, distribute, modify or otherwise make use
+  of this software may be licensed only pursuant to the terms
+  of an applicable ShenZhen Panath license agreement.
+ ***************************************************************/
+
+#ifndef	___RBTREE_HPP
+#define	___RBTREE_HPP
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "rbtree.h"
+
+/*
+  C++ layer of rbtree.h, header only.
+  The comparator is a template parameter, so the search loops are
+  inlined same as the hand written rule_tpl functions. Unlike the rule
+  tables, the trees here keep the std order: smaller keys first.
+ */
+namespace rb {
+
+/*
+  hook of the intrusive trees, the value type derives from it once per
+  tree it may be linked into, the Tag tells the hooks apart.
+ */
+template <class Tag = void>
+struct set_hook : rb_node {
+    set_hook() { rb_init_node(this); }
+    set_hook(const set_hook &) : rb_node() { rb_init_node(this); }
+    set_hook &operator=(const set_hook &) { return *this; }
+
+    bool is_linked() const { return !RB_EMPTY_NODE(this); }
+};
+
+/* key extractors of the intrusive trees */
+template <class T>
+struct identity_key {
+    typedef T type;
+    const T &operator()(const T &v) const { return v; }
+};
+
+template <class T, class K, K T::*Member>
+struct member_key {
+    typedef K type;
+    const K &operator()(const T &v) const { return v.*Member; }
+};
+
+/*
+  bidirectional iterator over rb_next/rb_prev, end() is the NULL node,
+  the root is kept so that --end() gives the last node.
+ */
+template <class Traits, bool Const>
+class tree_iterator {
+public:
+    typedef std::bidirectional_iterator_tag  iterator_category;
+    typedef typename Traits::value_type      value_type;
+    typedef std::ptrdiff_t                   difference_type;
+    typedef typename std::conditional<Const, const value_type *,
+                                      value_type *>::type pointer;
+    typedef typename std::conditional<Const, const value_type &,
+                                      value_type &>::type reference;
+
+    tree_iterator() : node_(NULL), root_(NULL) {}
+    tree_iterator(rb_node *node, const rb_root *root)
+        : node_(node), root_(root) {}
+
+    /* iterator to const_iterator */
+    template <bool C, class = typename std::enable_if<Const && !C>::type>
+    tree_iterator(const tree_iterator<Traits, C> &other)
+        : node_(other.node()), root_(other.root()) {}
+
+    reference operator*() const { return Traits::value(node_); }
+    pointer operator->() const { return &Traits::value(node_); }
+
+    tree_iterator &operator++()
+    {
+        node_ = rb_next(node_);
+        return *this;
+    }
+    tree_iterator operator++(int)
+    {
+        tree_iterator tmp = *this;
+        ++*this;
+        return tmp;
+    }
+    tree_iterator &operator--()
+    {
+        node_ = node_ ? rb_prev(node_) : rb_last(root_);
+        return *this;
+    }
+    tree_iterator operator--(int)
+    {
+        tree_iterator tmp = *this;
+        --*this;
+        return tmp;
+    }
+
+    friend bool operator==(const tree_iterator &a, const tree_iterator &b)
+    {
+        return a.node_ == b.node_;
+    }
+    friend bool operator!=(const tree_iterator &a, const tree_iterator &b)
+    {
+        return a.node_ != b.node_;
+    }
+
+    rb_node *node() const { return node_; }
+    const rb_root *root() const { return root_; }
+
+private:
+    rb_node       *node_;
+    const rb_root *root_;
+};
+
+/*
+  intrusive tree
+  T must derive from set_hook<Tag>. The tree never allocates nor frees,
+  the objects must outlive their link in the tree.
+  KeyOf   : extracts the key from T, see identity_key and member_key
+  Compare : strict weak order of the keys
+ */
+template <class T, class KeyOf, class Compare, class Tag = void>
+class intrusive_tree {
+    typedef set_hook<Tag> hook_type;
+
+    struct traits {
+        typedef T value_type;
+        static T &value(rb_node *node)
+        {
+            return *static_cast<T *>(static_cast<hook_type *>(node));
+        }
+    };
+
+public:
+    typedef typename KeyOf::type                      key_type;
+    typedef T                                         value_type;
+    typedef Compare                                   key_compare;
+    typedef std::size_t                               size_type;
+    typedef tree_iterator<traits, false>              iterator;
+    typedef tree_iterator<traits, true>               const_iterator;
+    typedef std::reverse_iterator<iterator>           reverse_iterator;
+    typedef std::reverse_iterator<const_iterator>     const_reverse_iterator;
+
+    explicit intrusive_tree(const Compare &comp = Compare())
+        : size_(0), comp_(comp)
+    {
+        root_.rb_node = NULL;
+    }
+
+    /* the nodes do not point to the root, so moving it is enough */
+    intrusive_tree(intrusive_tree &&other)
+        : root_(other.root_), size_(other.size_), comp_(other.comp_)
+    {
+        other.root_.rb_node = NULL;
+        other.size_ = 0;
+    }
+    intrusive_tree &operator=(intrusive_tree &&other)
+    {
+        if (this != &other) {
+            clear();
+            root_ = other.root_;
+            size_ = other.size_;
+            comp_ = other.comp_;
+            other.root_.rb_node = NULL;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+    intrusive_tree(const intrusive_tree &) = delete;
+    intrusive_tree &operator=(const intrusive_tree &) = delete;
+
+    ~intrusive_tree() { clear(); }
+
+    iterator begin() { return iterator(rb_first(&root_), &root_); }
+    iterator end() { return iterator(NULL, &root_); }
+    const_iterator begin() const
+    {
+        return const_iterator(rb_first(&root_), &root_);
+    }
+    const_iterator end() const { return const_iterator(NULL, &root_); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const
+    {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    bool empty() const { return NULL == root_.rb_node; }
+    size_type size() const { return size_; }
+
+    /* the C root, for rb_erase_range(), rb_diff() and the like */
+    rb_root *root() { return &root_; }
+
+    /* link v, or return the node of the same key */
+    std::pair<iterator, bool> insert(T &v)
+    {
+        rb_node **link = &root_.rb_node;
+        rb_node *parent = NULL;
+        const key_type &key = KeyOf()(v);
+
+        while (*link) {
+            parent = *link;
+            const key_type &cur = KeyOf()(traits::value(parent));
+            if (comp_(key, cur)) {
+                link = &parent->rb_left;
+            }
+            else if (comp_(cur, key)) {
+                link = &parent->rb_right;
+            }
+            else {
+                return std::make_pair(iterator(parent, &root_), false);
+            }
+        }
+
+        rb_node *node = to_node(v);
+        rb_link_node(node, parent, link);
+        rb_insert_color(node, &root_);
+        size_++;
+        return std::make_pair(iterator(node, &root_), true);
+    }
+
+    /* unlink the node, return the next one */
+    iterator erase(const_iterator pos)
+    {
+        rb_node *node = pos.node();
+        rb_node *next = rb_next(node);
+
+        rb_erase(node, &root_);
+        RB_CLEAR_NODE(node);
+        size_--;
+        return iterator(next, &root_);
+    }
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+    iterator erase(T &v) { return erase(const_iterator(to_node(v), &root_)); }
+    size_type erase(const key_type &key)
+    {
+        rb_node *node = lookup(key);
+        if (NULL == node) {
+            return 0;
+        }
+        erase(const_iterator(node, &root_));
+        return 1;
+    }
+
+    iterator find(const key_type &key)
+    {
+        return iterator(lookup(key), &root_);
+    }
+    const_iterator find(const key_type &key) const
+    {
+        return const_iterator(lookup(key), &root_);
+    }
+    size_type count(const key_type &key) const
+    {
+        return lookup(key) ? 1 : 0;
+    }
+    iterator lower_bound(const key_type &key)
+    {
+        return iterator(bound(key, false), &root_);
+    }
+    const_iterator lower_bound(const key_type &key) const
+    {
+        return const_iterator(bound(key, false), &root_);
+    }
+    iterator upper_bound(const key_type &key)
+    {
+        return iterator(bound(key, true), &root_);
+    }
+    const_iterator upper_bound(const key_type &key) const
+    {
+        return const_iterator(bound(key, true), &root_);
+    }
+
+    iterator iterator_to(T &v) { return iterator(to_node(v), &root_); }
+
+    /* unlink all the nodes */
+    void clear() { clear_and_dispose(null_disposer()); }
+
+    /*
+      unlink all the nodes and hand every one to dispose, without
+      recursion, same walk as rule_tpl_node_clear().
+     */
+    template <class Disposer>
+    void clear_and_dispose(Disposer dispose)
+    {
+        rb_node *node = root_.rb_node;
+        rb_node *parent;
+
+        while (node) {
+            if (node->rb_left) {
+                node = node->rb_left;
+            }
+            else if (node->rb_right) {
+                node = node->rb_right;
+            }
+            else {
+                parent = rb_parent(node);
+                if (parent) {
+                    if (parent->rb_left == node) {
+                        parent->rb_left = NULL;
+                    }
+                    else {
+                        parent->rb_right = NULL;
+                    }
+                }
+                RB_CLEAR_NODE(node);
+                dispose(&traits::value(node));
+                node = parent;
+            }
+        }
+        root_.rb_node = NULL;
+        size_ = 0;
+    }
+
+    void swap(intrusive_tree &other)
+    {
+        std::swap(root_, other.root_);
+        std::swap(size_, other.size_);
+        std::swap(comp_, other.comp_);
+    }
+
+private:
+    struct null_disposer {
+        void operator()(T *) const {}
+    };
+
+    static rb_node *to_node(T &v)
+    {
+        return static_cast<hook_type *>(&v);
+    }
+
+    rb_node *lookup(const key_type &key) const
+    {
+        rb_node *node = root_.rb_node;
+
+        while (node) {
+            const key_type &cur = KeyOf()(traits::value(node));
+            if (comp_(key, cur)) {
+                node = node->rb_left;
+            }
+            else if (comp_(cur, key)) {
+                node = node->rb_right;
+            }
+            else {
+                return node;
+            }
+        }
+        return NULL;
+    }
+
+    /* first node not before key, or after key if upper */
+    rb_node *bound(const key_type &key, bool upper) const
+    {
+        rb_node *node = root_.rb_node;
+        rb_node *found = NULL;
+
+        while (node) {
+            const key_type &cur = KeyOf()(traits::value(node));
+            if (upper ? comp_(key, cur) : !comp_(cur, key)) {
+                found = node;
+                node = node->rb_left;
+            }
+            else {
+                node = node->rb_right;
+            }
+        }
+        return found;
+    }
+
+    rb_root      root_;
+    size_type    size_;
+    Compare      comp_;
+};
+
+/* T is its own key */
+template <class T, class Compare = std::less<T>, class Tag = void>
+using intrusive_set = intrusive_tree<T, identity_key<T>, Compare, Tag>;
+
+/* the key is the member Key of T */
+template <class T, class K, K T::*Key, class Compare = std::less<K>,
+          class Tag = void>
+using intrusive_map = intrusive_tree<T, member_key<T, K, Key>, Compare, Tag>;
+
+/*
+  owning map
+  Each value lives in one node of Alloc, next to its rb_node, so a
+  lookup touches one cache line per level like the rule tables. The
+  mapped type may be move only. Nodes can be extracted and inserted
+  again, in the same map or another one of the same allocator, without
+  being reallocated.
+ */
+template <class K, class V, class Compare = std::less<K>,
+          class Alloc = std::allocator<std::pair<const K, V> > >
+class map {
+    struct node : rb_node {
+        template <class... Args>
+        node(Args &&... args) : value(std::forward<Args>(args)...) {}
+
+        std::pair<const K, V> value;
+    };
+
+    struct traits {
+        typedef std::pair<const K, V> value_type;
+        static value_type &value(rb_node *n)
+        {
+            return static_cast<node *>(n)->value;
+        }
+    };
+
+    typedef typename std::allocator_traits<Alloc>::template
+        rebind_alloc<node>                            node_alloc;
+    typedef std::allocator_traits<node_alloc>         node_traits;
+
+public:
+    typedef K                                         key_type;
+    typedef V                                         mapped_type;
+    typedef std::pair<const K, V>                     value_type;
+    typedef Compare                                   key_compare;
+    typedef Alloc                                     allocator_type;
+    typedef std::size_t                               size_type;
+    typedef tree_iterator<traits, false>              iterator;
+    typedef tree_iterator<traits, true>               const_iterator;
+    typedef std::reverse_iterator<iterator>           reverse_iterator;
+    typedef std::reverse_iterator<const_iterator>     const_reverse_iterator;
+
+    /* an extracted node, it owns the value until inserted again */
+    class node_type {
+    public:
+        typedef K      key_type;
+        typedef V      mapped_type;
+        typedef Alloc  allocator_type;
+
+        node_type() : node_(NULL) {}
+        node_type(node_type &&other)
+            : node_(other.node_), alloc_(std::move(other.alloc_))
+        {
+            other.node_ = NULL;
+        }
+        node_type &operator=(node_type &&other)
+        {
+            if (this != &other) {
+                reset();
+                node_ = other.node_;
+                alloc_ = std::move(other.alloc_);
+                other.node_ = NULL;
+            }
+            return *this;
+        }
+        ~node_type() { reset(); }
+
+        bool empty() const { return NULL == node_; }
+        explicit operator bool() const { return NULL != node_; }
+
+        /* the key may be changed before the node is inserted again */
+        key_type &key() const
+        {
+            return const_cast<key_type &>(node_->value.first);
+        }
+        mapped_type &mapped() const { return node_->value.second; }
+
+    private:
+        friend class map;
+
+        node_type(node *n, const node_alloc &alloc)
+            : node_(n), alloc_(alloc) {}
+
+        void reset()
+        {
+            if (node_) {
+                node_traits::destroy(alloc_, node_);
+                node_traits::deallocate(alloc_, node_, 1);
+                node_ = NULL;
+            }
+        }
+
+        node       *node_;
+        node_alloc  alloc_;
+    };
+
+    struct insert_return_type {
+        iterator   position;
+        bool       inserted;
+        node_type  node;
+    };
+
+    explicit map(const Compare &comp = Compare(), const Alloc &alloc = Alloc())
+        : size_(0), comp_(comp), alloc_(alloc)
+    {
+        root_.rb_node = NULL;
+    }
+    map(map &&other)
+        : root_(other.root_), size_(other.size_), comp_(other.comp_),
+          alloc_(std::move(other.alloc_))
+    {
+        other.root_.rb_node = NULL;
+        other.size_ = 0;
+    }
+    map &operator=(map &&other)
+    {
+        if (this != &other) {
+            clear();
+            root_ = other.root_;
+            size_ = other.size_;
+            comp_ = other.comp_;
+            alloc_ = std::move(other.alloc_);
+            other.root_.rb_node = NULL;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+    map(const map &) = delete;
+    map &operator=(const map &) = delete;
+
+    ~map() { clear(); }
+
+    allocator_type get_allocator() const { return allocator_type(alloc_); }
+
+    iterator begin() { return iterator(rb_first(&root_), &root_); }
+    iterator end() { return iterator(NULL, &root_); }
+    const_iterator begin() const
+    {
+        return const_iterator(rb_first(&root_), &root_);
+    }
+    const_iterator end() const { return const_iterator(NULL, &root_); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const
+    {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    bool empty() const { return NULL == root_.rb_node; }
+    size_type size() const { return size_; }
+
+    /* build the value in place, dropped again if the key exists */
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args)
+    {
+        node *n = make_node(std::forward<Args>(args)...);
+        rb_node **link;
+        rb_node *parent;
+        rb_node *found = locate(n->value.first, &link, &parent);
+
+        if (found) {
+            drop_node(n);
+            return std::make_pair(iterator(found, &root_), false);
+        }
+        link_node(n, parent, link);
+        return std::make_pair(iterator(n, &root_), true);
+    }
+
+    /* build the value only if the key does not exist */
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const key_type &key, Args &&... args)
+    {
+        return try_emplace_key(key, std::forward<Args>(args)...);
+    }
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(key_type &&key, Args &&... args)
+    {
+        return try_emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    std::pair<iterator, bool> insert(const value_type &v) { return emplace(v); }
+    std::pair<iterator, bool> insert(value_type &&v)
+    {
+        return emplace(std::move(v));
+    }
+
+    /* link an extracted node, handed back in node if the key exists */
+    insert_return_type insert(node_type &&nh)
+    {
+        insert_return_type ret;
+        rb_node **link;
+        rb_node *parent;
+        rb_node *found;
+
+        if (nh.empty()) {
+            ret.position = end();
+            ret.inserted = false;
+            return ret;
+        }
+
+        found = locate(nh.node_->value.first, &link, &parent);
+        if (found) {
+            ret.position = iterator(found, &root_);
+            ret.inserted = false;
+            ret.node = std::move(nh);
+            return ret;
+        }
+        link_node(nh.node_, parent, link);
+        ret.position = iterator(nh.node_, &root_);
+        ret.inserted = true;
+        nh.node_ = NULL;
+        return ret;
+    }
+
+    mapped_type &operator[](const key_type &key)
+    {
+        return try_emplace(key).first->second;
+    }
+    mapped_type &operator[](key_type &&key)
+    {
+        return try_emplace(std::move(key)).first->second;
+    }
+    mapped_type &at(const key_type &key)
+    {
+        rb_node *n = lookup(key);
+        if (NULL == n) {
+            throw std::out_of_range("rb::map::at");
+        }
+        return traits::value(n).second;
+    }
+    const mapped_type &at(const key_type &key) const
+    {
+        rb_node *n = lookup(key);
+        if (NULL == n) {
+            throw std::out_of_range("rb::map::at");
+        }
+        return traits::value(n).second;
+    }
+
+    iterator find(const key_type &key)
+    {
+        return iterator(lookup(key), &root_);
+    }
+    const_iterator find(const key_type &key) const
+    {
+        return const_iterator(lookup(key), &root_);
+    }
+    size_type count(const key_type &key) const
+    {
+        return lookup(key) ? 1 : 0;
+    }
+    iterator lower_bound(const key_type &key)
+    {
+        return iterator(bound(key, false), &root_);
+    }
+    const_iterator lower_bound(const key_type &key) const
+    {
+        return const_iterator(bound(key, false), &root_);
+    }
+    iterator upper_bound(const key_type &key)
+    {
+        return iterator(bound(key, true), &root_);
+    }
+    const_iterator upper_bound(const key_type &key) const
+    {
+        return const_iterator(bound(key, true), &root_);
+    }
+
+    /* unlink the node without releasing it */
+    node_type extract(const_iterator pos)
+    {
+        rb_node *n = pos.node();
+
+        rb_erase(n, &root_);
+        size_--;
+        return node_type(static_cast<node *>(n), alloc_);
+    }
+    node_type extract(const key_type &key)
+    {
+        rb_node *n = lookup(key);
+        if (NULL == n) {
+            return node_type();
+        }
+        return extract(const_iterator(n, &root_));
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        rb_node *n = pos.node();
+        rb_node *next = rb_next(n);
+
+        rb_erase(n, &root_);
+        size_--;
+        drop_node(static_cast<node *>(n));
+        return iterator(next, &root_);
+    }
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+    size_type erase(const key_type &key)
+    {
+        rb_node *n = lookup(key);
+        if (NULL == n) {
+            return 0;
+        }
+        erase(const_iterator(n, &root_));
+        return 1;
+    }
+
+    /* release all the nodes without recursion */
+    void clear()
+    {
+        rb_node *n = root_.rb_node;
+        rb_node *parent;
+
+        while (n) {
+            if (n->rb_left) {
+                n = n->rb_left;
+            }
+            else if (n->rb_right) {
+                n = n->rb_right;
+            }
+            else {
+                parent = rb_parent(n);
+                if (parent) {
+                    if (parent->rb_left == n) {
+                        parent->rb_left = NULL;
+                    }
+                    else {
+                        parent->rb_right = NULL;
+                    }
+                }
+                drop_node(static_cast<node *>(n));
+                n = parent;
+            }
+        }
+        root_.rb_node = NULL;
+        size_ = 0;
+    }
+
+    void swap(map &other)
+    {
+        std::swap(root_, other.root_);
+        std::swap(size_, other.size_);
+        std::swap(comp_, other.comp_);
+        std::swap(alloc_, other.alloc_);
+    }
+
+private:
+    template <class... Args>
+    node *make_node(Args &&... args)
+    {
+        node *n = node_traits::allocate(alloc_, 1);
+        try {
+            node_traits::construct(alloc_, n, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            node_traits::deallocate(alloc_, n, 1);
+            throw;
+        }
+        return n;
+    }
+
+    void drop_node(node *n)
+    {
+        node_traits::destroy(alloc_, n);
+        node_traits::deallocate(alloc_, n, 1);
+    }
+
+    template <class Key, class... Args>
+    std::pair<iterator, bool> try_emplace_key(Key &&key, Args &&... args)
+    {
+        rb_node **link;
+        rb_node *parent;
+        rb_node *found = locate(key, &link, &parent);
+
+        if (found) {
+            return std::make_pair(iterator(found, &root_), false);
+        }
+
+        node *n = make_node(std::piecewise_construct,
+                            std::forward_as_tuple(std::forward<Key>(key)),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+        link_node(n, parent, link);
+        return std::make_pair(iterator(n, &root_), true);
+    }
+
+    /* the node of key, or NULL with the link to insert it at */
+    rb_node *locate(const key_type &key, rb_node ***link, rb_node **parent)
+    {
+        rb_node **cur = &root_.rb_node;
+
+        *parent = NULL;
+        while (*cur) {
+            *parent = *cur;
+            const key_type &k = traits::value(*cur).first;
+            if (comp_(key, k)) {
+                cur = &(*cur)->rb_left;
+            }
+            else if (comp_(k, key)) {
+                cur = &(*cur)->rb_right;
+            }
+            else {
+                return *cur;
+            }
+        }
+        *link = cur;
+        return NULL;
+    }
+
+    void link_node(node *n, rb_node *parent, rb_node **link)
+    {
+        rb_link_node(n, parent, link);
+        rb_insert_color(n, &root_);
+        size_++;
+    }
+
+    rb_node *lookup(const key_type &key) const
+    {
+        rb_node *n = root_.rb_node;
+
+        while (n) {
+            const key_type &k = traits::value(n).first;
+            if (comp_(key, k)) {
+                n = n->rb_left;
+            }
+            else if (comp_(k, key)) {
+                n = n->rb_right;
+            }
+            else {
+                return n;
+            }
+        }
+        return NULL;
+    }
+
+    rb_node *bound(const key_type &key, bool upper) const
+    {
+        rb_node *n = root_.rb_node;
+        rb_node *found = NULL;
+
+        while (n) {
+            const key_type &k = traits::value(n).first;
+            if (upper ? comp_(key, k) : !comp_(k, key)) {
+                found = n;
+                n = n->rb_left;
+            }
+            else {
+                n = n->rb_right;
+            }
+        }
+        return found;
+    }
+
+    rb_root      root_;
+    size_type    size_;
+    Compare      comp_;
+    node_alloc   alloc_;
+};
+
+} /* namespace rb */
+
+#endif	/* ___RBTREE_HPP */